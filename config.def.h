@@ -25,13 +25,23 @@
 #define DESKTOPS        4         /* number of desktops - edit DESKTOPCHANGE keys to suit */
 #define DEFAULT_DESKTOP 0         /* the desktop to focus on exec */
 #define MINWSZ          50        /* minimum window size in pixels */
+#define SYNC_TIMEOUT    100       /* ms to wait for a client to draw a size before sending the next one */
+#define GRAB_SERVER     0         /* grab the server for at most that many ms while a layout is applied, 0 to disable */
+#define CONFIGURE_RATE  20        /* denied configure requests per second a tiled client is answered, 0 for no limit */
+#define STALL_THRESHOLD 50        /* ms an event handler may run before it is reported as a stall, 0 to disable */
+#define SCRATCH_CLASS   "scratchpad" /* class or instance of the scratchpad window */
+#define CONFIG_FILE     ".monsterwmrc" /* in the home directory, read at start and on SIGHUP */
+#define FLIGHT_FILE     "/tmp/monsterwm.flight" /* the flight recorder is dumped there, suffixed with the pid */
+#define CGROUP_DIR      ""        /* delegated cgroup v2 directory for per desktop groups, "" to disable */
+#define CPU_WEIGHT      100       /* cpu.weight of the visible desktop's group */
+#define CPU_WEIGHT_BG   10        /* cpu.weight of the hidden desktops' groups */
 
 /* open applications to specified desktop with specified mode.
  * if desktop is negative, then current is assumed */
 static const AppRule rules[] = { \
-    /*  class     desktop  follow  float */
-    { "MPlayer",     3,    True,   False },
-    { "Gimp",        0,    False,  True  },
+    /*  class     desktop  follow  float   freeze */
+    { "MPlayer",     3,    True,   False,  False },
+    { "Gimp",        0,    False,  True,   False },
 };
 
 /* helper for spawning shell commands */
@@ -40,40 +50,43 @@ static const AppRule rules[] = { \
 /** commands **/
 static const char *termcmd[] = { "xterm",     NULL };
 static const char *menucmd[] = { "dmenu_run", NULL };
+static const char *scratchcmd[] = { "xterm", "-name", SCRATCH_CLASS, NULL }; /* started with the wm, kept hidden */
 
 #define DESKTOPCHANGE(K,N) \
-    {  MOD1,             K,              change_desktop, {.i = N}}, \
-    {  MOD1|ShiftMask,   K,              client_to_desktop, {.i = N}},
+    {  MOD1,             K,              change_desktop,    {.i = N},         False}, \
+    {  MOD1|ShiftMask,   K,              client_to_desktop, {.i = N},         False},
 
 /** Shortcuts **/
 static key keys[] = {
-    /* modifier          key            function           argument */
-    {  MOD1,             XK_b,          togglepanel,       {NULL}},
-    {  MOD1,             XK_BackSpace,  focusurgent,       {NULL}},
-    {  MOD1|SHIFT,       XK_c,          killclient,        {NULL}},
-    {  MOD1,             XK_j,          next_win,          {NULL}},
-    {  MOD1,             XK_k,          prev_win,          {NULL}},
-    {  MOD1,             XK_h,          resize_master,     {.i = -10}}, /* decrease size in px */
-    {  MOD1,             XK_l,          resize_master,     {.i = +10}}, /* increase size in px */
-    {  MOD1,             XK_m,          mouse_aside,       {NULL}},
-    {  MOD1,             XK_o,          resize_stack,      {.i = -10}}, /* shrink   size in px */
-    {  MOD1,             XK_p,          resize_stack,      {.i = +10}}, /* grow     size in px */
-    {  MOD1|CONTROL,     XK_h,          rotate,            {.i = -1}},
-    {  MOD1|CONTROL,     XK_l,          rotate,            {.i = +1}},
-    {  MOD1|SHIFT,       XK_h,          rotate_filled,     {.i = -1}},
-    {  MOD1|SHIFT,       XK_l,          rotate_filled,     {.i = +1}},
-    {  MOD1,             XK_Tab,        last_desktop,      {NULL}},
-    {  MOD1,             XK_Return,     swap_master,       {NULL}},
-    {  MOD1|SHIFT,       XK_j,          move_down,         {NULL}},
-    {  MOD1|SHIFT,       XK_k,          move_up,           {NULL}},
-    {  MOD1|SHIFT,       XK_t,          switch_mode,       {.i = TILE}},
-    {  MOD1|SHIFT,       XK_m,          switch_mode,       {.i = MONOCLE}},
-    {  MOD1|SHIFT,       XK_b,          switch_mode,       {.i = BSTACK}},
-    {  MOD1|SHIFT,       XK_g,          switch_mode,       {.i = GRID}},
-    {  MOD1|CONTROL,     XK_r,          quit,              {.i = 0}}, /* quit with exit value 0 */
-    {  MOD1|CONTROL,     XK_q,          quit,              {.i = 1}}, /* quit with exit value 1 */
-    {  MOD1|SHIFT,       XK_Return,     spawn,             {.com = termcmd}},
-    {  MOD4,             XK_v,          spawn,             {.com = menucmd}},
+    /* modifier          key            function           argument          repeat */
+    {  MOD1,             XK_b,          togglepanel,       {NULL},           False},
+    {  MOD1,             XK_grave,      togglescratch,     {NULL},           False},
+    {  MOD1,             XK_BackSpace,  focusurgent,       {NULL},           False},
+    {  MOD1|SHIFT,       XK_c,          killclient,        {NULL},           False},
+    {  MOD1,             XK_j,          next_win,          {NULL},           True },
+    {  MOD1,             XK_k,          prev_win,          {NULL},           True },
+    {  MOD1,             XK_h,          resize_master,     {.i = -10},       True }, /* decrease size in px */
+    {  MOD1,             XK_l,          resize_master,     {.i = +10},       True }, /* increase size in px */
+    {  MOD1,             XK_m,          mouse_aside,       {NULL},           False},
+    {  MOD1,             XK_o,          resize_stack,      {.i = -10},       True }, /* shrink   size in px */
+    {  MOD1,             XK_p,          resize_stack,      {.i = +10},       True }, /* grow     size in px */
+    {  MOD1|CONTROL,     XK_h,          rotate,            {.i = -1},        False},
+    {  MOD1|CONTROL,     XK_l,          rotate,            {.i = +1},        False},
+    {  MOD1|SHIFT,       XK_h,          rotate_filled,     {.i = -1},        False},
+    {  MOD1|SHIFT,       XK_l,          rotate_filled,     {.i = +1},        False},
+    {  MOD1,             XK_Tab,        last_desktop,      {NULL},           False},
+    {  MOD1,             XK_Return,     swap_master,       {NULL},           False},
+    {  MOD1|SHIFT,       XK_j,          move_down,         {NULL},           False},
+    {  MOD1|SHIFT,       XK_k,          move_up,           {NULL},           False},
+    {  MOD1|SHIFT,       XK_t,          switch_mode,       {.i = TILE},      False},
+    {  MOD1|SHIFT,       XK_m,          switch_mode,       {.i = MONOCLE},   False},
+    {  MOD1|SHIFT,       XK_b,          switch_mode,       {.i = BSTACK},    False},
+    {  MOD1|SHIFT,       XK_g,          switch_mode,       {.i = GRID},      False},
+    {  MOD1|CONTROL,     XK_r,          quit,              {.i = 0},         False}, /* quit with exit value 0 */
+    {  MOD1|CONTROL,     XK_q,          quit,              {.i = 1},         False}, /* quit with exit value 1 */
+    {  MOD1|SHIFT,       XK_r,          reload,            {NULL},           False}, /* read CONFIG_FILE again */
+    {  MOD1|SHIFT,       XK_Return,     spawn,             {.com = termcmd}, False},
+    {  MOD4,             XK_v,          spawn,             {.com = menucmd}, False},
        DESKTOPCHANGE(    XK_F1,                             0)
        DESKTOPCHANGE(    XK_F2,                             1)
        DESKTOPCHANGE(    XK_F3,                             2)
@@ -81,8 +94,10 @@ static key keys[] = {
 };
 
 static Button buttons[] = {
-    {  MOD1,    Button1,     mousemotion,   {.i = MOVE}},
-    {  MOD1,    Button3,     mousemotion,   {.i = RESIZE}},
-    {  MOD4,    Button3,     spawn,         {.com = menucmd}},
+    {  MOD1,          Button1,     mousemotion,   {.i = MOVE}},
+    {  MOD1,          Button3,     mousemotion,   {.i = RESIZE}},
+    {  MOD1|SHIFT,    Button1,     mousemotion,   {.i = MOVE|OUTLINE}},   /* drag an outline, the window */
+    {  MOD1|SHIFT,    Button3,     mousemotion,   {.i = RESIZE|OUTLINE}}, /* follows on button release  */
+    {  MOD4,          Button3,     spawn,         {.com = menucmd}},
 };
 #endif
@@ -1,19 +1,35 @@
 /* see license for copyright and license */
 
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE /* POSIX_SPAWN_SETSID */
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <err.h>
+#include <ctype.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
 #include <X11/keysym.h>
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/xcb_atom.h>
 #include <xcb/xcb_icccm.h>
 #include <xcb/xcb_keysyms.h>
+#include <xcb/sync.h>
 
 /* TODO: Reduce SLOC */
 
@@ -26,6 +42,28 @@
 #  define DEBUGP(x,...) ;
 #endif
 
+/* static tracepoints for perf and bpftrace, found as sdt:monsterwm:*
+ * they are nops until attached to, and compiled out without sys/sdt.h
+ * or with -DNOSDT */
+#if !defined(NOSDT) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    include <sys/sdt.h>
+#  endif
+#endif
+#ifdef DTRACE_PROBE
+#  define PROBE(x)          DTRACE_PROBE(monsterwm, x);
+#  define PROBE1(x,a)       DTRACE_PROBE1(monsterwm, x, a);
+#  define PROBE2(x,a,b)     DTRACE_PROBE2(monsterwm, x, a, b);
+#else
+#  define PROBE(x)          ;
+#  define PROBE1(x,a)       ;
+#  define PROBE2(x,a,b)     ;
+#endif
+
+/* fatal errors dump the flight recorder first, see flightdump() */
+#define err(...)  (flightdump(), err(__VA_ARGS__))
+#define errx(...) (flightdump(), errx(__VA_ARGS__))
+
 /* upstream compatility */
 #define True  true
 #define False false
@@ -36,23 +74,42 @@
 #define Button1      XCB_BUTTON_INDEX_1
 #define Button2      XCB_BUTTON_INDEX_2
 #define Button3      XCB_BUTTON_INDEX_3
-#define XCB_MOVE_RESIZE XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT
-#define XCB_MOVE        XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y
-#define XCB_RESIZE      XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT
-
-static char *WM_ATOM_NAME[]   = { "WM_PROTOCOLS", "WM_DELETE_WINDOW" };
-static char *NET_ATOM_NAME[]  = { "_NET_SUPPORTED", "_NET_WM_STATE_FULLSCREEN", "_NET_WM_STATE", "_NET_ACTIVE_WINDOW" };
+#define Button4      XCB_BUTTON_INDEX_4
+#define Button5      XCB_BUTTON_INDEX_5
+#define XCB_MOVE_RESIZE (XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT)
+#define XCB_BORDER      XCB_CONFIG_WINDOW_BORDER_WIDTH
+
+static char *WM_ATOM_NAME[]   = { "WM_PROTOCOLS", "WM_DELETE_WINDOW", "WM_STATE" };
+static char *NET_ATOM_NAME[]  = { "_NET_SUPPORTED", "_NET_WM_STATE_FULLSCREEN", "_NET_WM_STATE", "_NET_ACTIVE_WINDOW",
+                                  "_NET_WM_SYNC_REQUEST", "_NET_WM_SYNC_REQUEST_COUNTER", "_NET_WM_STATE_HIDDEN",
+                                  "_NET_WM_STATE_FOCUSED", "_NET_CLIENT_LIST", "_NET_CLIENT_LIST_STACKING",
+                                  "_NET_NUMBER_OF_DESKTOPS", "_NET_CURRENT_DESKTOP", "_NET_WM_DESKTOP",
+                                  "_NET_WM_BYPASS_COMPOSITOR", "_NET_WM_PID" };
 
 #define LENGTH(x) (sizeof(x)/sizeof(*x))
 #define CLEANMASK(mask) (mask & ~(numlockmask | XCB_MOD_MASK_LOCK))
 #define BUTTONMASK      XCB_EVENT_MASK_BUTTON_PRESS|XCB_EVENT_MASK_BUTTON_RELEASE
 #define ISFFT(c)        (c->isfullscrn || c->isfloating || c->istransient)
-#define USAGE           "usage: monsterwm [-h] [-v]"
-
-enum { RESIZE, MOVE };
+#define USAGE           "usage: monsterwm [-h] [-v] [-T] [-r trace] [-R trace] [-F dump]"
+#define MAXCOOKIES      8
+#define MAXSTATES       8    /* _NET_WM_STATE atoms kept per client besides the wm's own */
+#define SEQRANGES       32
+#define EVBATCH         64
+#define TRACEMAGIC      "MWMTRC01"
+#define FLIGHTRECS      4096 /* records kept by the flight recorder, a power of two */
+#define FLIGHTMAGIC     "MWMFLT01"
+#define REPLY           128  /* stalls of reply callbacks are accounted past the event types */
+
+enum { RESIZE, MOVE, OUTLINE = 1<<1 }; /* OUTLINE drags a wireframe, see drag() */
+enum { IGNORE_ENTER = 1<<0, IGNORE_UNMAP = 1<<1 };
+enum { STATE_HIDDEN = 1<<0, STATE_FOCUSED = 1<<1, STATE_FULLSCREEN = 1<<2 };
 enum { TILE, MONOCLE, BSTACK, GRID, MODES };
-enum { WM_PROTOCOLS, WM_DELETE_WINDOW, WM_COUNT };
-enum { NET_SUPPORTED, NET_FULLSCREEN, NET_WM_STATE, NET_ACTIVE, NET_COUNT };
+enum { FL_EVENT, FL_LAYOUT, FL_CONFIGURE, FL_MAP, FL_UNMAP, FL_RAISE, FL_FOCUS, FL_DESKTOP, FL_ERROR, FL_WAIT, FL_STALL,
+       FL_KINDS };
+enum { WM_PROTOCOLS, WM_DELETE_WINDOW, WM_STATE, WM_COUNT };
+enum { NET_SUPPORTED, NET_FULLSCREEN, NET_WM_STATE, NET_ACTIVE, NET_SYNC, NET_SYNC_COUNTER, NET_HIDDEN, NET_FOCUSED,
+       NET_CLIENT_LIST, NET_CLIENT_STACKING, NET_NUMBER_OF_DESKTOPS, NET_CURRENT_DESKTOP, NET_WM_DESKTOP,
+       NET_BYPASS_COMPOSITOR, NET_WM_PID, NET_COUNT };
 
 /* argument structure to be passed to function by config.h
  * com  - a command to run
@@ -68,12 +125,14 @@ typedef union {
  * keysym   - and the key pressed
  * func     - the function to be triggered because of the above combo
  * arg      - the argument to the function
+ * repeat   - whether auto-repeated presses are coalesced, see dispatch()
  */
 typedef struct {
     unsigned int mod;
     xcb_keysym_t keysym;
     void (*func)(const Arg *);
     const Arg arg;
+    bool repeat;
 } key;
 
 /* a button struct represents a combination of
@@ -96,15 +155,47 @@ typedef struct {
  * istransient - set when the window is transient
  * isfullscrn  - set when the window is fullscreen
  * isfloating  - set when the window is floating
+ * ishidden    - set when the layout hides the window, see monocle() and tile()
+ * isiconic    - set when the window was unmapped because it is hidden
+ * state       - the STATE_* flags last published on the window, -1 if none
  * win         - the window this client is representing
+ * geom        - the geometry the window should have: x, y, width, height, border
+ * sent        - the geometry that was last sent to the window
+ * dirty       - the fields of geom that were set since the last commit
+ * known       - the fields of sent that are known to match the window
+ * alarm       - the alarm on the client's _NET_WM_SYNC_REQUEST counter, or 0
+ * syncvalue   - the counter value the client was last asked to reach
+ * syncing     - set while the client has not yet drawn the last size sent
+ * synctime    - when the last size was sent to a syncing client
+ * requests    - the configure requests of the tiled client denied in the current second
+ * reqtime     - when that second started
+ * pid         - the window's _NET_WM_PID, or 0 if not set or the window is remote
+ * freeze      - set when a rule places the window's process in the frozen group
+ * states      - the atoms of _NET_WM_STATE the client set that the wm doesn't manage
+ * nstates     - the number of those atoms
  *
  * istransient is separate from isfloating as floating window can be reset
  * to their tiling positions, while the transients will always be floating
+ *
+ * the fields of geom, sent, dirty and known are in the order
+ * of the XCB_CONFIG_WINDOW_* bits, see commit()
  */
 typedef struct client {
     struct client *next;
-    bool isurgent, istransient, isfullscrn, isfloating;
+    bool isurgent, istransient, isfullscrn, isfloating, ishidden, isiconic;
     xcb_window_t win;
+    int geom[5], sent[5], state;
+    unsigned int dirty, known;
+    xcb_sync_alarm_t alarm;
+    uint64_t syncvalue;
+    bool syncing;
+    double synctime;
+    unsigned int requests;
+    double reqtime;
+    pid_t pid;
+    bool freeze;
+    xcb_atom_t states[MAXSTATES];
+    unsigned int nstates;
 } client;
 
 /* properties of each desktop
@@ -123,50 +214,168 @@ typedef struct {
     bool showpanel;
 } desktop;
 
+/* an async request, its replies are collected by the main loop
+ *
+ * next     - the request that was sent after this one
+ * win      - the window the request is about
+ * data     - extra data for the continuation
+ * n        - the number of X requests that make up the request
+ * done     - the number of replies collected so far
+ * seq      - the sequence numbers of the X requests
+ * reply    - the collected replies, NULL on error or for void requests
+ * func     - the continuation, called once all replies are collected
+ */
+typedef struct cookie {
+    struct cookie *next;
+    xcb_window_t win;
+    void *data, *reply[MAXCOOKIES];
+    unsigned int n, done, seq[MAXCOOKIES];
+    void (*func)(struct cookie *r);
+} cookie;
+
+/* a range of requests sent by the wm itself
+ * first    - the sequence number of the first request in the range
+ * last     - the sequence number of the last request in the range
+ * mask     - the events generated by those requests that are ignored
+ */
+typedef struct {
+    unsigned int first, last, mask;
+} seqrange;
+
+/* a record of the flight recorder, see flight()
+ * time     - microseconds since start, wrapping after about 71 minutes
+ * kind     - what happened, one of FL_*
+ * detail   - the event type, layout mode, configure mask, new desktop,
+ *            error code, the request waited for, or the stalled handler,
+ *            see handlername()
+ * win      - the window it is about, or 0
+ * value    - the time spent in the handler, layout or focus change in
+ *            microseconds, the sequence number of the request, the
+ *            previous desktop, or the request that failed
+ */
+typedef struct {
+    uint32_t time;
+    uint16_t kind, detail;
+    uint32_t win, value;
+} flightrec;
+
+/* a record of an event trace, see record() and replay()
+ * usec     - the time the event was handled, in microseconds since start
+ * event    - the event as received from the server
+ */
+typedef struct {
+    uint64_t usec;
+    uint8_t event[32];
+} tracerecord;
+
+/* a list of windows published in a root window property
+ * win      - the windows, as last written to the property
+ * n        - the number of windows in the list
+ * size     - the number of windows there is room for
+ */
+typedef struct {
+    xcb_window_t *win;
+    unsigned int n, size;
+} winlist;
+
 /* define behavior of certain applications
  * configured in config.h
  * class    - the class or name of the instance
  * desktop  - what desktop it should be spawned at
  * follow   - whether to change desktop focus to the specified desktop
+ * floating - whether the window starts floating
+ * freeze   - whether the application is frozen while its desktop is hidden
  */
 typedef struct {
     const char *class;
     const int desktop;
-    const bool follow, floating;
+    const bool follow, floating, freeze;
 } AppRule;
 
+/* the settings that can change at runtime, the defaults of config.h
+ * with the configuration file applied, see readconfig()
+ * text         - the file's contents, the strings below point in there
+ * args         - the argument vectors of spawned commands
+ * keys         - the key bindings, nkeys of them
+ * buttons      - the button bindings, nbuttons of them
+ * rules        - the application rules, nrules of them
+ * focus        - the color of the focused window's border
+ * unfocus      - the color of the unfocused windows' border
+ */
+typedef struct {
+    char *text, **args;
+    key *keys;
+    Button *buttons;
+    AppRule *rules;
+    unsigned int nkeys, nbuttons, nrules;
+    char *focus, *unfocus;
+    float mastersize;
+    int borderwidth, panelheight;
+} config;
+
  /* function prototypes sorted alphabetically */
 static client* addwindow(xcb_window_t w);
 static void buttonpress(xcb_generic_event_t *e);
+static void cgwrite(int d, bool frozen, const char *file, const char *fmt, ...);
 static void change_desktop(const Arg *arg);
 static void cleanup(void);
 static void client_to_desktop(const Arg *arg);
+static void clientlist(xcb_window_t w, bool add);
 static void clientmessage(xcb_generic_event_t *e);
+static void commit(void);
 static void configurerequest(xcb_generic_event_t *e);
+static void crash(int sig);
+static void dumpsignal(int sig);
 static void deletewindow(xcb_window_t w);
 static void desktopinfo(void);
+static void dumpstats(void);
 static void destroynotify(xcb_generic_event_t *e);
+static void dispatch(xcb_generic_event_t **batch, unsigned int n);
+static void drag(const Arg *arg, int mx, int my, int winx, int winy, int winw, int winh, unsigned int grab);
+static void dragstart(cookie *r);
 static void enternotify(xcb_generic_event_t *e);
+static void flight(unsigned int kind, unsigned int detail, xcb_window_t win, uint32_t value);
+static bool flightdump(void);
+static void flightprint(const char *path);
+static void flushinfo(void);
 static void focusurgent();
-static unsigned int getcolor(char* color);
-static void grabbuttons(client *c);
+static void freeconfig(config *c);
+static void getcolor(char* color, unsigned int *pixel);
+static void grabbuttons(void);
+static void grabkey(const key *k, bool grab);
 static void grabkeys(void);
 static void grid(int h, int y);
+static const char* handlername(unsigned int type);
+static void keepstate(client *c, xcb_atom_t atom, unsigned int action);
 static void keypress(xcb_generic_event_t *e);
 static void killclient();
+static void killwindow(cookie *r);
 static void last_desktop();
+static pid_t launch(const char **com);
+static void loadconfig(void);
+static bool lookup(char kind, const char *name, unsigned int *value);
+static void manage(cookie *r);
+static void mappingnotify(xcb_generic_event_t *e);
 static void maprequest(xcb_generic_event_t *e);
 static void monocle(int h, int y);
 static void move_down();
 static void move_up();
+static void moveresize(client *c, int x, int y, int w, int h);
 static void mouse_aside();
 static void mousemotion(const Arg *arg);
-static void next_win();
+static void next_win(const Arg *arg);
 static client* prev_client();
-static void prev_win();
+static void prev_win(const Arg *arg);
+static unsigned int priority(xcb_generic_event_t *e, xcb_window_t *w);
 static void propertynotify(xcb_generic_event_t *e);
 static void quit(const Arg *arg);
+static bool readconfig(config *c);
+static void recolor(void);
+static void record(xcb_generic_event_t *e);
+static void reload();
 static void removeclient(client *c);
+static bool repeatable(xcb_key_press_event_t *ev);
+static void replay(const char *path);
 static void resize_master(const Arg *arg);
 static void resize_stack(const Arg *arg);
 static void rotate(const Arg *arg);
@@ -174,29 +383,84 @@ static void rotate_filled(const Arg *arg);
 static void run(void);
 static void save_desktop(int i);
 static void select_desktop(int i);
+static void setborder(client *c, int w);
+static void setclientstate(client *c, bool hidden, bool focused);
+static void setcolor(cookie *r);
 static void setfullscreen(client *c, bool fullscrn);
+static void seticonic(client *c, bool iconic);
+static void setnumlock(cookie *r);
 static int setup(int default_screen);
-static void sigchld();
+static size_t sigappend(char *buf, size_t n, size_t size, const char *s, unsigned long v, unsigned int base);
+static void signals(void);
 static void spawn(const Arg *arg);
+static void stackinfo(xcb_window_t *w, unsigned int n);
+static void startup_phase(const char *name);
 static void stack(int h, int y);
+static void syncnotify(xcb_generic_event_t *e);
+static bool syncrequest(client *c);
 static void swap_master();
 static void switch_mode(const Arg *arg);
 static void tile(void);
 static void togglepanel();
+static void togglescratch();
 static void update_current(client *c);
 static void unmapnotify(xcb_generic_event_t *e);
+static void urgenthint(cookie *r);
+static bool validarg(void (*func)(const Arg *), int i, bool repeat);
+static void watcharm(bool on);
+static void watchbegin(unsigned int type, xcb_window_t win);
+static void watchdog(int sig);
+static double watchend(void);
 static client* wintoclient(xcb_window_t w);
+static void xerror(xcb_generic_event_t *e);
 
 #include "config.h"
 
 /* variables */
-static bool running = true, showpanel = SHOW_PANEL;
-static int previous_desktop = 0, current_desktop = 0, retval = 0;
+static bool running = true, showpanel = SHOW_PANEL, timings = false;
+static int previous_desktop = 0, current_desktop = 0, visible_desktop = 0, retval = 0;
 static int wh, ww, mode = DEFAULT_MODE, master_size = 0, growth = 0;
 static unsigned int numlockmask = 0, win_unfocus, win_focus;
 static xcb_connection_t *dis;
 static xcb_screen_t *screen;
+static xcb_key_symbols_t *keysyms;
+static FILE *trace;
+static winlist clients, stacking;
+static double tstart, tphase;
+static int sigfd = -1;
+static unsigned int nlaunch, nsuppressed, ndropped, ncoalesced, ndenied, nthrottled;
+static unsigned int presses = 1; /* key presses coalesced into the one being handled */
+static xcb_button_press_event_t *press; /* the button press being handled */
+static unsigned int nclients, ncookies, peakclients, peakcookies; /* live allocations, and most ever live */
+static char status[2][DESKTOPS * 48]; /* the snapshot being written and the latest one, each within PIPE_BUF */
+typedef char status_fits_pipe_buf[DESKTOPS * 48 <= PIPE_BUF ? 1:-1]; /* so a write after poll() can not block */
+static size_t statuslen[2], statusoff;
+static double tlaunch, tlaunchmax; /* total and worst launch latency in ms */
+static xcb_window_t scratch; /* the scratchpad window, kept unmapped until toggled */
+static bool scratchshown = false;
+static pid_t scratchpid;
+static double scratchstart;
+static struct utsname host; /* the nodename is compared to the windows' WM_CLIENT_MACHINE */
+static seqrange ranges[SEQRANGES];
+static flightrec flightlog[FLIGHTRECS];
+static const char *flightkinds[FL_KINDS] = { "event", "layout", "configure", "map", "unmap", "raise", "focus",
+                                             "desktop", "error", "wait", "stall" };
+static unsigned int flightpos; /* records ever added, the next one goes at flightpos % FLIGHTRECS */
+static char flightpath[4096];
+static volatile sig_atomic_t watching, watchgen, watchreported; /* the handler being run, see watchdog() */
+static unsigned int watchtype;
+static xcb_window_t watchwin;
+static double watchstart;
+static bool watcharmed;
+static unsigned int stalls[REPLY + 1], stallhist[5]; /* stalls per handler, and by up to 2, 4, 8, 16 times the threshold and longer */
+static unsigned int rfirst, nranges;
+static bool rangeopen = false;
+static bool hassync = false, syncheld = false;
 static client *head, *prevfocus, *current;
+static cookie *rqhead, *rqtail;
+static unsigned int xerrors[256]; /* error count per X request major opcode */
+
+static config cfg;
 
 static xcb_atom_t wmatoms[WM_COUNT], netatoms[NET_COUNT];
 static desktop desktops[DESKTOPS];
@@ -213,6 +477,13 @@ static void (*layout[MODES])(int h, int y) = {
     [TILE] = stack, [BSTACK] = stack, [GRID] = grid, [MONOCLE] = monocle,
 };
 
+/* current time of the monotonic clock in milliseconds */
+static double msnow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
 /* get screen of display */
 static xcb_screen_t *xcb_screen_of_display(xcb_connection_t *con, int screen) {
     xcb_screen_iterator_t iter;
@@ -221,58 +492,69 @@ static xcb_screen_t *xcb_screen_of_display(xcb_connection_t *con, int screen) {
     return NULL;
 }
 
-/* wrapper to move and resize window */
-static inline void xcb_move_resize(xcb_connection_t *con, xcb_window_t win, int x, int y, int w, int h) {
-    unsigned int pos[4] = { x, y, w, h };
-    xcb_configure_window(con, win, XCB_MOVE_RESIZE, pos);
+/* remember that the request with the given sequence number was sent by
+ * the wm and that events of the given mask it generates are ignored.
+ * requests sent in the same run() iteration share one range */
+static void xcb_track(unsigned int seq, unsigned int mask) {
+    seqrange *r = &ranges[(rfirst + nranges - 1) % SEQRANGES];
+    if (rangeopen && nranges) { r->last = seq; r->mask |= mask; return; }
+    if (nranges == SEQRANGES) { rfirst = (rfirst + 1) % SEQRANGES; nranges--; }
+    r = &ranges[(rfirst + nranges++) % SEQRANGES];
+    r->first = r->last = seq; r->mask = mask;
+    rangeopen = true;
+}
+
+/* check if the event was generated by a request of the wm itself
+ * events arrive in sequence order, so the ranges that were sent
+ * before the event can be forgotten */
+static bool xcb_ignored(xcb_generic_event_t *ev) {
+    unsigned int type = ev->response_type & ~0x80, mask = 0;
+    while (nranges && (int16_t)(ev->sequence - (uint16_t)ranges[rfirst].last) > 0) {
+        rfirst = (rfirst + 1) % SEQRANGES; nranges--;
+    }
+    if (type == XCB_ENTER_NOTIFY) mask = IGNORE_ENTER;
+    else if (type == XCB_UNMAP_NOTIFY) mask = IGNORE_UNMAP;
+    if (!mask || ev->response_type & 0x80) return false;
+    for (unsigned int i = 0; i < nranges; i++) {
+        seqrange *r = &ranges[(rfirst + i) % SEQRANGES];
+        if (r->mask & mask && (uint16_t)(ev->sequence - r->first) <= (uint16_t)(r->last - r->first)) return true;
+    }
+    return false;
 }
 
-/* wrapper to move window */
-static inline void xcb_move(xcb_connection_t *con, xcb_window_t win, int x, int y) {
-    unsigned int pos[2] = { x, y };
-    xcb_configure_window(con, win, XCB_MOVE, pos);
+/* wrapper to map window */
+static inline void xcb_map(xcb_connection_t *con, xcb_window_t win) {
+    unsigned int seq = xcb_map_window(con, win).sequence;
+    PROBE1(map, win)
+    flight(FL_MAP, 0, win, seq);
+    xcb_track(seq, IGNORE_ENTER);
 }
 
-/* wrapper to resize window */
-static inline void xcb_resize(xcb_connection_t *con, xcb_window_t win, int w, int h) {
-    unsigned int pos[2] = { w, h };
-    xcb_configure_window(con, win, XCB_RESIZE, pos);
+/* wrapper to unmap window */
+static inline void xcb_unmap(xcb_connection_t *con, xcb_window_t win) {
+    unsigned int seq = xcb_unmap_window(con, win).sequence;
+    PROBE1(unmap, win)
+    flight(FL_UNMAP, 0, win, seq);
+    xcb_track(seq, IGNORE_ENTER|IGNORE_UNMAP);
 }
 
 /* wrapper to raise window */
 static inline void xcb_raise_window(xcb_connection_t *con, xcb_window_t win) {
     unsigned int arg[1] = { XCB_STACK_MODE_ABOVE };
-    xcb_configure_window(con, win, XCB_CONFIG_WINDOW_STACK_MODE, arg);
-}
-
-/* wrapper to set xcb border width */
-static inline void xcb_border_width(xcb_connection_t *con, xcb_window_t win, int w) {
-    unsigned int arg[1] = { w };
-    xcb_configure_window(con, win, XCB_CONFIG_WINDOW_BORDER_WIDTH, arg);
+    unsigned int seq = xcb_configure_window(con, win, XCB_CONFIG_WINDOW_STACK_MODE, arg).sequence;
+    PROBE1(raise, win)
+    flight(FL_RAISE, 0, win, seq);
+    xcb_track(seq, IGNORE_ENTER);
 }
 
 /* wrapper to get xcb keysymbol from keycode */
 static xcb_keysym_t xcb_get_keysym(xcb_keycode_t keycode) {
-    xcb_key_symbols_t *keysyms;
-    xcb_keysym_t       keysym;
-
-    if (!(keysyms = xcb_key_symbols_alloc(dis))) return 0;
-    keysym = xcb_key_symbols_get_keysym(keysyms, keycode, 0);
-    xcb_key_symbols_free(keysyms);
-
-    return keysym;
+    return keysyms ? xcb_key_symbols_get_keysym(keysyms, keycode, 0) : 0;
 }
 
 /* wrapper to get xcb keycodes from keysymbol */
 static xcb_keycode_t* xcb_get_keycodes(xcb_keysym_t keysym) {
-    xcb_key_symbols_t *keysyms;
-    xcb_keycode_t     *keycode;
-
-    if (!(keysyms = xcb_key_symbols_alloc(dis))) return NULL;
-    keycode = xcb_key_symbols_get_keycode(keysyms, keysym);
-    xcb_key_symbols_free(keysyms);
-
-    return keycode;
+    return keysyms ? xcb_key_symbols_get_keycode(keysyms, keysym) : NULL;
 }
 
 /* retieve RGB color from hex (think of html) */
@@ -282,37 +564,117 @@ static unsigned int xcb_get_colorpixel(char *hex) {
     return (rgb16[0] << 16) + (rgb16[1] << 8) + rgb16[2];
 }
 
-/* wrapper to get atoms using xcb */
-static void xcb_get_atoms(char **names, xcb_atom_t *atoms, unsigned int count) {
-    xcb_intern_atom_cookie_t cookies[count];
+/* wrapper to get atoms using xcb, requests are sent by xcb_intern_atoms */
+static void xcb_get_atoms(char **names, xcb_intern_atom_cookie_t *cookies, xcb_atom_t *atoms, unsigned int count) {
     xcb_intern_atom_reply_t  *reply;
 
-    for (unsigned int i = 0; i < count; i++) cookies[i] = xcb_intern_atom(dis, 0, strlen(names[i]), names[i]);
     for (unsigned int i = 0; i < count; i++) {
         reply = xcb_intern_atom_reply(dis, cookies[i], NULL); /* TODO: Handle error */
         if (reply) {
             DEBUGP("%s : %d\n", names[i], reply->atom);
             atoms[i] = reply->atom; free(reply);
-        } else puts("WARN: monsterwm failed to register %s atom.\nThings might not work right.");
+        } else fprintf(stderr, "WARN: monsterwm failed to register %s atom.\nThings might not work right.\n", names[i]);
     }
 }
 
-/* wrapper to window get attributes using xcb */
-static void xcb_get_attributes(xcb_window_t *windows, xcb_get_window_attributes_reply_t **reply, unsigned int count) {
-    xcb_get_window_attributes_cookie_t cookies[count];
-    for (unsigned int i = 0; i < count; i++) cookies[i] = xcb_get_window_attributes(dis, windows[i]);
-    for (unsigned int i = 0; i < count; i++) reply[i]   = xcb_get_window_attributes_reply(dis, cookies[i], NULL); /* TODO: Handle error */
+/* wrapper to request atoms using xcb */
+static void xcb_intern_atoms(char **names, xcb_intern_atom_cookie_t *cookies, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) cookies[i] = xcb_intern_atom(dis, 0, strlen(names[i]), names[i]);
 }
 
-/* check if other wm exists */
-static int xcb_checkotherwm(void) {
-    xcb_generic_error_t *error;
+/* select the events handled by the wm on the root window
+ * only one client can redirect substructure, see xcb_checkotherwm */
+static xcb_void_cookie_t xcb_select_root(void) {
     unsigned int values[1] = {XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT|XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY|
                               XCB_EVENT_MASK_PROPERTY_CHANGE|XCB_EVENT_MASK_BUTTON_PRESS};
-    error = xcb_request_check(dis, xcb_change_window_attributes_checked(dis, screen->root, XCB_CW_EVENT_MASK, values));
-    xcb_flush(dis);
-    if (error) return 1;
-    return 0;
+    return xcb_change_window_attributes_checked(dis, screen->root, XCB_CW_EVENT_MASK, values);
+}
+
+/* check if other wm exists */
+static int xcb_checkotherwm(xcb_void_cookie_t cookie) {
+    xcb_generic_error_t *error;
+    if (!(error = xcb_request_check(dis, cookie))) return 0;
+    free(error);
+    return 1;
+}
+
+/* get the visual type of the root window */
+static xcb_visualtype_t* xcb_root_visual(void) {
+    for (xcb_depth_iterator_t d = xcb_screen_allowed_depths_iterator(screen); d.rem; xcb_depth_next(&d))
+        for (xcb_visualtype_iterator_t v = xcb_depth_visuals_iterator(d.data); v.rem; xcb_visualtype_next(&v))
+            if (v.data->visual_id == screen->root_visual) return v.data;
+    return NULL;
+}
+
+/* compute the pixel of an RGB color on a TrueColor visual from its masks */
+static unsigned int xcb_truecolor_pixel(xcb_visualtype_t *visual, unsigned int rgb) {
+    unsigned int masks[3] = { visual->red_mask, visual->green_mask, visual->blue_mask }, pixel = 0;
+    for (unsigned int i = 0, m, shift, bits, v; i < 3; i++) {
+        for (m = masks[i], shift = 0; m && !(m & 1); m >>= 1) shift++;
+        for (bits = 0; m & 1; m >>= 1) bits++;
+        v = rgb >> (16 - 8*i) & 0xFF;
+        pixel |= ((bits < 8 ? v >> (8 - bits) : v << (bits - 8)) << shift) & masks[i];
+    }
+    return pixel;
+}
+
+/* publish the list of windows in the root window property, sending
+ * only what changed since the list was last published. windows
+ * added at the end or the start of the list are appended or
+ * prepended, any other change rewrites the whole property */
+static void xcb_publish_windows(winlist *l, xcb_atom_t prop, xcb_window_t *w, unsigned int n) {
+    size_t sz = sizeof(xcb_window_t);
+    if (n == l->n && (!n || !memcmp(w, l->win, n * sz))) return;
+    if (n > l->n && (!l->n || !memcmp(w, l->win, l->n * sz)))
+        xcb_change_property(dis, XCB_PROP_MODE_APPEND, screen->root, prop, XCB_ATOM_WINDOW, 32, n - l->n, w + l->n);
+    else if (n > l->n && !memcmp(w + n - l->n, l->win, l->n * sz))
+        xcb_change_property(dis, XCB_PROP_MODE_PREPEND, screen->root, prop, XCB_ATOM_WINDOW, 32, n - l->n, w);
+    else xcb_change_property(dis, XCB_PROP_MODE_REPLACE, screen->root, prop, XCB_ATOM_WINDOW, 32, n, w);
+    if (n > l->size && !(l->win = realloc(l->win, (l->size = n * 2) * sz))) err(EXIT_FAILURE, "cannot allocate window list");
+    memcpy(l->win, w, n * sz);
+    l->n = n;
+}
+
+/* queue an async request made of n X requests, given by their sequence
+ * numbers. func is called from the main loop once all replies are in */
+static void xcb_async(xcb_window_t win, void *data, void (*func)(cookie *r), unsigned int n, ...) {
+    cookie *r;
+    va_list ap;
+    if (!(r = calloc(1, sizeof(cookie)))) err(EXIT_FAILURE, "cannot allocate request");
+    if (++ncookies > peakcookies) peakcookies = ncookies;
+    r->win = win; r->data = data; r->func = func;
+    va_start(ap, n);
+    for (; r->n < n && r->n < MAXCOOKIES; r->n++) r->seq[r->n] = va_arg(ap, unsigned int);
+    va_end(ap);
+    if (rqtail) rqtail->next = r; else rqhead = r;
+    rqtail = r;
+}
+
+/* drop the callbacks of the queued async requests about a window that
+ * is gone, replies that were made before it went would act on a dead
+ * window. the replies are still collected */
+static void xcb_cancel(xcb_window_t win) {
+    for (cookie *r = rqhead; r; r = r->next) if (r->win == win) r->func = NULL;
+}
+
+/* collect the replies of the queued async requests without blocking
+ * replies arrive in the order the requests were sent, so stop
+ * at the first request still waiting. errors are counted per request
+ * type. returns whether any request was completed */
+static bool xcb_collect(void) {
+    xcb_generic_error_t *e;
+    bool completed = false;
+    for (cookie *r; (r = rqhead); completed = true) {
+        for (; r->done < r->n; r->done++) {
+            if (!xcb_poll_for_reply(dis, r->seq[r->done], &r->reply[r->done], &e)) return completed;
+            if (e) { xerror((xcb_generic_event_t*)e); free(e); }
+        }
+        if (!(rqhead = r->next)) rqtail = NULL;
+        if (r->func) { watchbegin(REPLY, r->win); r->func(r); watchend(); }
+        for (unsigned int i = 0; i < r->n; i++) free(r->reply[i]);
+        free(r); ncookies--;
+    }
+    return completed;
 }
 
 /* create a new client and add the new window
@@ -321,56 +683,95 @@ static int xcb_checkotherwm(void) {
 client* addwindow(xcb_window_t w) {
     client *c, *t = prev_client(head);
     if (!(c = (client *)calloc(1, sizeof(client)))) err(EXIT_FAILURE, "cannot allocate client");
+    if (++nclients > peakclients) peakclients = nclients;
+    c->state = -1;
 
     if (!head) head = c;
     else if (!ATTACH_ASIDE) { c->next = head; head = c; }
     else if (t) t->next = c; else head->next = c;
 
     unsigned int values[1] = { XCB_EVENT_MASK_PROPERTY_CHANGE|(FOLLOW_MOUSE?XCB_EVENT_MASK_ENTER_WINDOW:0) };
-    xcb_change_window_attributes_checked(dis, (c->win = w), XCB_CW_EVENT_MASK, values);
+    xcb_async(w, NULL, NULL, 1, xcb_change_window_attributes_checked(dis, (c->win = w), XCB_CW_EVENT_MASK, values).sequence);
     return c;
 }
 
-/* on the press of a button check to see if there's a binded function to call */
+/* on the press of a button check to see if there's a binded function to call
+ * buttons are grabbed on the root window, the clicked client is the child.
+ * with CLICK_TO_FOCUS the pointer is frozen until the click is either
+ * consumed by a binding or replayed to the client */
 void buttonpress(xcb_generic_event_t *e) {
     xcb_button_press_event_t *ev = (xcb_button_press_event_t*)e;
     DEBUGP("xcb: button press: %d state: %d\n", ev->detail, ev->state);
 
-    client *c = wintoclient(ev->event);
-    if (!c) return;
-    if (CLICK_TO_FOCUS && current != c && ev->detail == XCB_BUTTON_INDEX_1) update_current(c);
+    bool binded = false;
+    client *c = wintoclient(ev->event == screen->root ? ev->child : ev->event);
+    if (c && CLICK_TO_FOCUS && current != c && ev->detail == XCB_BUTTON_INDEX_1) update_current(c);
 
-    for (unsigned int i=0; i<LENGTH(buttons); i++)
-        if (buttons[i].func && buttons[i].button == ev->detail &&
-            CLEANMASK(buttons[i].mask) == CLEANMASK(ev->state)) {
+    press = ev;
+    for (unsigned int i=0; c && i<cfg.nbuttons; i++)
+        if (cfg.buttons[i].func && cfg.buttons[i].button == ev->detail &&
+            CLEANMASK(cfg.buttons[i].mask) == CLEANMASK(ev->state)) {
+            if (CLICK_TO_FOCUS && !binded) xcb_allow_events(dis, XCB_ALLOW_ASYNC_POINTER, ev->time);
             if (current != c) update_current(c);
-            buttons[i].func(&(buttons[i].arg));
+            cfg.buttons[i].func(&(cfg.buttons[i].arg));
+            binded = true;
         }
+    press = NULL;
 
-    if (CLICK_TO_FOCUS) {
+    if (CLICK_TO_FOCUS && !binded) {
         xcb_allow_events(dis, XCB_ALLOW_REPLAY_POINTER, ev->time);
         xcb_flush(dis);
     }
 }
 
+/* write to a file of desktop d's cgroup, or of its frozen subgroup, or
+ * of CGROUP_DIR itself if d is negative. nothing is done if CGROUP_DIR
+ * is empty, and errors are ignored, as the wm works the same without */
+void cgwrite(int d, bool frozen, const char *file, const char *fmt, ...) {
+    char path[256];
+    va_list ap;
+    int fd;
+
+    if (!CGROUP_DIR[0]) return;
+    if (d < 0) snprintf(path, sizeof(path), "%s/%s", CGROUP_DIR, file);
+    else snprintf(path, sizeof(path), "%s/desktop%d%s/%s", CGROUP_DIR, d, frozen ? "/frozen":"", file);
+    if ((fd = open(path, O_WRONLY|O_CLOEXEC)) == -1) return;
+    va_start(ap, fmt);
+    vdprintf(fd, fmt, ap);
+    va_end(ap);
+    close(fd);
+}
+
 /* focus another desktop
  *
  * to avoid flickering
- * first map the new windows
+ * first lay out the new windows, so they map in place
+ * then map the new windows, except those the layout hides
  * first the current window and then all other
  * then unmap the old windows
- * first all others then the current */
+ * first all others then the current
+ * and mark them hidden, so their clients can throttle
+ * then give the cpu to the applications of the new desktop
+ * and freeze those that asked for it on the old one */
 void change_desktop(const Arg *arg) {
     if (arg->i == current_desktop) return;
+    PROBE2(desktop, current_desktop, arg->i)
+    flight(FL_DESKTOP, arg->i, 0, current_desktop);
     previous_desktop = current_desktop;
-    select_desktop(arg->i);
-    if (current) xcb_map_window(dis, current->win);
-    for (client *c=head; c; c=c->next) xcb_map_window(dis, c->win);
+    select_desktop(visible_desktop = arg->i);
+    xcb_change_property(dis, XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_CURRENT_DESKTOP], XCB_ATOM_CARDINAL, 32, 1, &arg->i);
+    tile(); commit();
+    if (current && !current->isiconic) xcb_map(dis, current->win);
+    for (client *c=head; c; c=c->next) if (!c->isiconic) xcb_map(dis, c->win);
     select_desktop(previous_desktop);
-    for (client *c=head; c; c=c->next) if (c != current) xcb_unmap_window(dis, c->win);
-    if (current) xcb_unmap_window(dis, current->win);
+    for (client *c=head; c; c=c->next) { if (c != current) xcb_unmap(dis, c->win); setclientstate(c, true, false); }
+    if (current) xcb_unmap(dis, current->win);
     select_desktop(arg->i);
-    tile(); update_current(current);
+    update_current(current);
+    cgwrite(arg->i, false, "cpu.weight", "%d", CPU_WEIGHT);
+    cgwrite(arg->i, true, "cgroup.freeze", "0");
+    cgwrite(previous_desktop, false, "cpu.weight", "%d", CPU_WEIGHT_BG);
+    cgwrite(previous_desktop, true, "cgroup.freeze", "1");
     desktopinfo();
 }
 
@@ -386,6 +787,17 @@ void cleanup(void) {
         free(query);
     }
     xcb_set_input_focus(dis, XCB_INPUT_FOCUS_POINTER_ROOT, screen->root, XCB_CURRENT_TIME);
+    if (keysyms) xcb_key_symbols_free(keysyms);
+    if (sigfd != -1) close(sigfd);
+    if (trace) fclose(trace);
+    for (int d=0; d<DESKTOPS; d++) cgwrite(d, true, "cgroup.freeze", "0");
+    free(clients.win); free(stacking.win);
+    freeconfig(&cfg);
+    for (cookie *r; (r = rqhead); free(r)) {
+        rqhead = r->next;
+        for (unsigned int i = 0; i < r->n; i++) free(r->reply[i]);
+    }
+    rqtail = NULL;
 }
 
 /* move a client to another desktop
@@ -404,13 +816,29 @@ void client_to_desktop(const Arg *arg) {
     select_desktop(cd);
     if (c == head || !p) head = c->next; else p->next = c->next;
     c->next = NULL;
-    xcb_unmap_window(dis, c->win);
+    xcb_unmap(dis, c->win);
+    xcb_change_property(dis, XCB_PROP_MODE_REPLACE, c->win, netatoms[NET_WM_DESKTOP], XCB_ATOM_CARDINAL, 32, 1, &arg->i);
+    if (c->pid) cgwrite(arg->i, c->freeze, "cgroup.procs", "%d", c->pid);
     update_current(prevfocus);
 
     if (FOLLOW_WINDOW) change_desktop(arg); else tile();
     desktopinfo();
 }
 
+/* add or remove the window from _NET_CLIENT_LIST, which is in mapping
+ * order, and _NET_CLIENT_LIST_STACKING, where new windows start at the
+ * bottom until update_current() restacks them */
+void clientlist(xcb_window_t w, bool add) {
+    xcb_window_t cl[clients.n + 1], sl[stacking.n + 1];
+    unsigned int n = 0, m = 0;
+    if (add) sl[m++] = w;
+    for (unsigned int i=0; i<clients.n; i++)  if (clients.win[i] != w)  cl[n++] = clients.win[i];
+    for (unsigned int i=0; i<stacking.n; i++) if (stacking.win[i] != w) sl[m++] = stacking.win[i];
+    if (add) cl[n++] = w;
+    xcb_publish_windows(&clients, netatoms[NET_CLIENT_LIST], cl, n);
+    xcb_publish_windows(&stacking, netatoms[NET_CLIENT_STACKING], sl, m);
+}
+
 /* To change the state of a mapped window, a client MUST
  * send a _NET_WM_STATE client message to the root window
  * message_type must be _NET_WM_STATE
@@ -424,6 +852,8 @@ void client_to_desktop(const Arg *arg) {
 void clientmessage(xcb_generic_event_t *e) {
     xcb_client_message_event_t *ev = (xcb_client_message_event_t*)e;
     client *t = NULL, *c = wintoclient(ev->window);
+    if (c && ev->type == netatoms[NET_WM_STATE])
+        for (unsigned int i=1; i<3; i++) keepstate(c, ev->data.data32[i], ev->data.data32[0]);
     if (c && ev->type                      == netatoms[NET_WM_STATE]
           && ((unsigned)ev->data.data32[1] == netatoms[NET_FULLSCREEN]
           ||  (unsigned)ev->data.data32[2] == netatoms[NET_FULLSCREEN]))
@@ -433,30 +863,98 @@ void clientmessage(xcb_generic_event_t *e) {
     tile();
 }
 
+/* apply the geometry changes queued by the layout in one burst
+ *
+ * every window gets a single configure with only the fields that
+ * differ from what it already has, so clients never see the half
+ * applied states of a layout pass, and unchanged windows see nothing.
+ * if GRAB_SERVER is set the burst is sent inside a server grab, so a
+ * compositor doesn't repaint in between, but never for longer than
+ * GRAB_SERVER milliseconds.
+ *
+ * clients supporting _NET_WM_SYNC_REQUEST are sent a new size only
+ * once they have drawn the previous one, until then the latest
+ * geometry is held, see syncrequest()
+ *
+ * last, the windows of the visible desktop that the layout
+ * shows or hides are mapped or unmapped */
+void commit(void) {
+    bool grabbed = false, capped = false;
+    double t = 0;
+    save_desktop(current_desktop);
+    syncheld = false;
+    for (int d=0; d<DESKTOPS; d++) for (client *c=desktops[d].head; c; c=c->next) {
+        unsigned int mask = 0, n = 0, v[5];
+        for (unsigned int i=0; i<5; i++)
+            if (c->dirty & 1<<i && (!(c->known & 1<<i) || c->sent[i] != c->geom[i])) mask |= 1<<i;
+        if (c->alarm && mask & (XCB_CONFIG_WINDOW_WIDTH|XCB_CONFIG_WINDOW_HEIGHT) && !syncrequest(c)) { syncheld = true; continue; }
+        for (unsigned int i=0; i<5; i++) if (mask & 1<<i) v[n++] = c->sent[i] = c->geom[i];
+        c->known |= mask; c->dirty = 0;
+        if (!mask) continue;
+        if (GRAB_SERVER && !grabbed && !capped) { xcb_grab_server(dis); grabbed = true; t = msnow(); }
+        unsigned int seq = xcb_configure_window(dis, c->win, mask, v).sequence;
+        PROBE2(configure, c->win, mask)
+        flight(FL_CONFIGURE, mask, c->win, seq);
+        xcb_track(seq, IGNORE_ENTER);
+        if (grabbed && msnow() - t > GRAB_SERVER) { xcb_ungrab_server(dis); grabbed = false; capped = true; }
+    }
+
+    /* map the windows the layout shows, then unmap those it hides */
+    for (client *c=desktops[visible_desktop].head; c; c=c->next) if (c->isiconic && !c->ishidden) seticonic(c, false);
+    for (client *c=desktops[visible_desktop].head; c; c=c->next) if (!c->isiconic && c->ishidden) seticonic(c, true);
+    if (grabbed) xcb_ungrab_server(dis);
+}
+
 /* a configure request means that the window requested changes in its geometry
- * state. if the window is fullscreen discard and fill the screen else set the
- * appropriate values as requested, and tile the window again so that it fills
- * the gaps that otherwise could have been created
+ * state. if the window is fullscreen discard and fill the screen. if it is
+ * tiled deny it, as ICCCM allows, with a synthetic ConfigureNotify of the
+ * geometry it has, applying it would only be undone by the next tile().
+ * a tiled window whose geometry is not known yet, such as one placed on
+ * a hidden desktop that was never laid out, is not denied but configured.
+ * else set the appropriate values as requested, and tile the window again
+ * so that it fills the gaps that otherwise could have been created.
+ *
+ * a tiled client denied more than CONFIGURE_RATE times in a second is
+ * fighting the layout, its other requests in that second are ignored
+ * without an answer. the requests of other windows are never dropped
  */
 void configurerequest(xcb_generic_event_t *e) {
     xcb_configure_request_event_t *ev = (xcb_configure_request_event_t*)e;
     client *c = wintoclient(ev->window);
+    double now = msnow();
+
     if (c && c->isfullscrn) setfullscreen(c, true);
-    else {
+    else if (c && !ISFFT(c) && (c->known & (XCB_MOVE_RESIZE|XCB_BORDER)) == (XCB_MOVE_RESIZE|XCB_BORDER)) {
+        if (now - c->reqtime >= 1000) { c->reqtime = now; c->requests = 0; }
+        if (CONFIGURE_RATE && ++c->requests > CONFIGURE_RATE) { nthrottled++; return; }
+        union { xcb_configure_notify_event_t ev; char pad[32]; } n = { .ev = {
+            .response_type = XCB_CONFIGURE_NOTIFY, .event = c->win, .window = c->win, .x = c->sent[0],
+            .y = c->sent[1], .width = c->sent[2], .height = c->sent[3], .border_width = c->sent[4] } };
+        xcb_send_event(dis, false, c->win, XCB_EVENT_MASK_STRUCTURE_NOTIFY, n.pad);
+        ndenied++;
+        return;
+    } else {
+        if (c) c->known &= ~ev->value_mask;
         unsigned int v[7];
         unsigned int i = 0;
         if (ev->value_mask & XCB_CONFIG_WINDOW_X)              v[i++] = ev->x;
-        if (ev->value_mask & XCB_CONFIG_WINDOW_Y)              v[i++] = (ev->y + (showpanel && TOP_PANEL)) ? PANEL_HEIGHT : 0;
-        if (ev->value_mask & XCB_CONFIG_WINDOW_WIDTH)          v[i++] = (ev->width  < ww - BORDER_WIDTH) ? ev->width  : ww + BORDER_WIDTH;
-        if (ev->value_mask & XCB_CONFIG_WINDOW_HEIGHT)         v[i++] = (ev->height < wh - BORDER_WIDTH) ? ev->height : wh + BORDER_WIDTH;
+        if (ev->value_mask & XCB_CONFIG_WINDOW_Y)              v[i++] = (ev->y + (showpanel && TOP_PANEL)) ? cfg.panelheight : 0;
+        if (ev->value_mask & XCB_CONFIG_WINDOW_WIDTH)          v[i++] = (ev->width  < ww - cfg.borderwidth) ? ev->width  : ww + cfg.borderwidth;
+        if (ev->value_mask & XCB_CONFIG_WINDOW_HEIGHT)         v[i++] = (ev->height < wh - cfg.borderwidth) ? ev->height : wh + cfg.borderwidth;
         if (ev->value_mask & XCB_CONFIG_WINDOW_BORDER_WIDTH)   v[i++] = ev->border_width;
         if (ev->value_mask & XCB_CONFIG_WINDOW_SIBLING)        v[i++] = ev->sibling;
         if (ev->value_mask & XCB_CONFIG_WINDOW_STACK_MODE)     v[i++] = ev->stack_mode;
-        xcb_configure_window(dis, ev->window, ev->value_mask, v);
+        xcb_track(xcb_configure_window(dis, ev->window, ev->value_mask, v).sequence, IGNORE_ENTER);
     }
     tile();
 }
 
+/* on a crash dump the flight recorder, then die of the signal as usual */
+void crash(int sig) {
+    flightdump();
+    raise(sig);
+}
+
 /* close the window */
 void deletewindow(xcb_window_t w) {
     xcb_client_message_event_t ev;
@@ -470,6 +968,45 @@ void deletewindow(xcb_window_t w) {
     xcb_send_event(dis, 0, w, XCB_EVENT_MASK_NO_EVENT, (char*)&ev);
 }
 
+/* print the wm's counters on standard error stream
+ * the launch latency of spawned commands, the events generated
+ * by the wm's own requests that were dropped, the errors
+ * received for each X request major opcode, and the clients,
+ * async requests, the replies and errors xcb holds for them and the
+ * resident memory, which should come back to where they were once
+ * the windows are gone, see soak.sh */
+void dumpstats(void) {
+    long pages = 0;
+    unsigned int queued = 0, errors = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f) { if (fscanf(f, "%*d %ld", &pages) != 1) pages = 0; fclose(f); }
+    for (cookie *r = rqhead; r; r = r->next) queued += r->n - r->done;
+    for (unsigned int i=0; i<LENGTH(xerrors); i++) errors += xerrors[i];
+    fprintf(stderr, "monsterwm: clients: %u peak: %u requests: %u peak: %u queued replies and errors: %u rss: %ld kB\n",
+            nclients, peakclients, ncookies, peakcookies, queued, pages * sysconf(_SC_PAGESIZE) / 1024);
+    fprintf(stderr, "monsterwm: errors: %u\n", errors);
+    fprintf(stderr, "monsterwm: launches: %u avg: %.3f ms max: %.3f ms\n", nlaunch, nlaunch ? tlaunch/nlaunch : 0, tlaunchmax);
+    fprintf(stderr, "monsterwm: suppressed events: %u coalesced key presses: %u\n", nsuppressed, ncoalesced);
+    fprintf(stderr, "monsterwm: dropped status updates: %u\n", ndropped);
+    fprintf(stderr, "monsterwm: configure requests denied: %u throttled: %u\n", ndenied, nthrottled);
+    fprintf(stderr, "monsterwm: stalls over %d ms: %u up to 2x: %u 4x: %u 8x: %u 16x: %u longer: %u\n", STALL_THRESHOLD,
+            stallhist[0] + stallhist[1] + stallhist[2] + stallhist[3] + stallhist[4],
+            stallhist[0], stallhist[1], stallhist[2], stallhist[3], stallhist[4]);
+    for (unsigned int i=0; i<LENGTH(stalls); i++)
+        if (stalls[i]) fprintf(stderr, "monsterwm: stalls: %s: %u\n", handlername(i), stalls[i]);
+    for (unsigned int i=0; i<LENGTH(xerrors); i++)
+        if (xerrors[i]) fprintf(stderr, "monsterwm: errors: request %u: %u\n", i, xerrors[i]);
+}
+
+/* on SIGUSR2 dump the flight recorder. it is a handler of its own, not
+ * read from the signal fd, so that a hung wm can be dumped too */
+void dumpsignal(int sig) {
+    int e = errno;
+    (void)sig;
+    flightdump();
+    errno = e;
+}
+
 /* output info about the desktops on standard output stream
  *
  * the info is a list of ':' separated values for each desktop
@@ -481,29 +1018,201 @@ void deletewindow(xcb_window_t w) {
  *   whether the desktop is the current focused (1) or not (0)
  *   whether any client in that desktop has received an urgent hint
  *
- * once the info is collected, immediately flush the stream */
+ * once the info is collected it replaces any snapshot the reader has
+ * not taken yet, and is written out as soon as the stream allows it */
 void desktopinfo(void) {
     bool urgent = false;
     int cd = current_desktop, n=0, d=0;
+    size_t len = 0;
+    if (statuslen[1]) ndropped++;
     for (client *c; d<DESKTOPS; d++) {
         for (select_desktop(d), c=head, n=0, urgent=false; c; c=c->next, ++n) if (c->isurgent) urgent = true;
-        fprintf(stdout, "%d:%d:%d:%d:%d%c", d, n, mode, current_desktop == cd, urgent, d+1==DESKTOPS?'\n':' ');
+        len += snprintf(status[1] + len, sizeof(status[1]) - len, "%d:%d:%d:%d:%d%c",
+                        d, n, mode, current_desktop == cd, urgent, d+1==DESKTOPS?'\n':' ');
+        if (len >= sizeof(status[1])) len = sizeof(status[1]) - 1;
     }
-    fflush(stdout);
+    statuslen[1] = len;
     if (cd != d-1) select_desktop(cd);
+    flushinfo();
 }
 
 /* a destroy notification is received when a window is being closed
  * on receival, remove the appropriate client that held that window
+ * and drop the pending replies about it, a window whose manage()
+ * replies are still in flight must not be managed once they arrive
  */
 void destroynotify(xcb_generic_event_t *e) {
     DEBUG("xcb: destoroy notify");
     xcb_destroy_notify_event_t *ev = (xcb_destroy_notify_event_t*)e;
     client *c = wintoclient(ev->window);
+    xcb_cancel(ev->window);
+    if (ev->window == scratch) { scratch = 0; scratchshown = false; }
     if (c) removeclient(c);
     desktopinfo();
 }
 
+/* handle a batch of events by priority, see priority(), in order of
+ * arrival within the same priority. an event never goes before an
+ * earlier event of the same window, it takes the lower priority.
+ *
+ * presses of a repeat binding's keys are coalesced: those that follow,
+ * up to a press of other keys, are dropped and counted in the first,
+ * so auto-repeat runs the binding once per batch, see keypress() */
+void dispatch(xcb_generic_event_t **batch, unsigned int n) {
+    unsigned int prio[n], count[n];
+    xcb_window_t win[n];
+    for (unsigned int i=0; i<n; i++) {
+        prio[i] = priority(batch[i], &win[i]);
+        count[i] = 1;
+        for (unsigned int j=0; win[i] && j<i; j++) if (win[j] == win[i] && prio[j] > prio[i]) prio[i] = prio[j];
+    }
+    for (unsigned int i=0; i<n; i++) {
+        xcb_key_press_event_t *ev = (xcb_key_press_event_t*)batch[i];
+        if (!ev || (ev->response_type & ~0x80) != XCB_KEY_PRESS || !repeatable(ev)) continue;
+        for (unsigned int j=i+1; j<n; j++) {
+            xcb_key_press_event_t *next = (xcb_key_press_event_t*)batch[j];
+            if (!next || (next->response_type & ~0x80) != XCB_KEY_PRESS) continue;
+            if (next->detail != ev->detail || next->state != ev->state) break;
+            free(batch[j]); batch[j] = NULL;
+            count[i]++; ncoalesced++;
+        }
+    }
+    for (unsigned int p=0; p<3; p++) for (unsigned int i=0; i<n; i++) {
+        if (prio[i] != p || !batch[i]) continue;
+        presses = count[i];
+        if (running) {
+            watchbegin(batch[i]->response_type & ~0x80, win[i]);
+            PROBE1(event__start, batch[i]->response_type & ~0x80)
+            if (events[batch[i]->response_type & ~0x80]) events[batch[i]->response_type & ~0x80](batch[i]);
+            else { DEBUGP("xcb: unimplented event: %d\n", batch[i]->response_type & ~0x80); }
+            PROBE1(event__done, batch[i]->response_type & ~0x80)
+            flight(FL_EVENT, batch[i]->response_type & ~0x80, win[i], watchend() * 1000);
+        }
+        free(batch[i]);
+    }
+    presses = 1;
+}
+
+/* until the mouse button has not been released,
+ * grab the interesting events - button press/release and pointer motion
+ * and on on pointer movement resize or move the window under the curson.
+ * if the received event is a map request or a configure request call the
+ * appropriate handler, and stop listening for other events.
+ * Ungrab the poitner and event handling is passed back to run() function.
+ * Once a window has been moved or resized, it's marked as floating.
+ *
+ * the drag starts from the pointer at mx, my and the window at winx, winy
+ * sized winw, winh. grab is the sequence of the pointer grab if its reply
+ * is still to come, or 0. if the grab failed the drag ends there, the
+ * window gets its floating and fullscreen state back, and the event that
+ * came with the reply is handled as run() would.
+ *
+ * with OUTLINE the window stays in place and a rectangle is drawn with
+ * xor on the root window instead, with the server grabbed so no client
+ * draws over it. the window is moved or resized once, on release. */
+void drag(const Arg *arg, int mx, int my, int winx, int winy, int winw, int winh, unsigned int grab) {
+    int xw, yh, gx, gy, gw, gh, b = cfg.borderwidth, mode = arg->i & ~OUTLINE;
+    bool outline = arg->i & OUTLINE, floating = current->isfloating, fullscrn = current->isfullscrn;
+    client *c = current;
+    xcb_gcontext_t gc = 0;
+
+    moveresize(current, winx, winy, winw, winh);
+    memcpy(current->sent, current->geom, sizeof(current->sent));
+    current->known |= XCB_MOVE_RESIZE;
+
+    if (current->isfullscrn) setfullscreen(current, False);
+    if (!current->isfloating) current->isfloating = True;
+    tile(); update_current(current);
+    gx = winx; gy = winy; gw = winw; gh = winh;
+    if (outline) {
+        unsigned int v[] = { XCB_GX_XOR, win_focus, b, XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS };
+        commit();
+        xcb_grab_server(dis);
+        xcb_create_gc(dis, (gc = xcb_generate_id(dis)), screen->root,
+                XCB_GC_FUNCTION|XCB_GC_FOREGROUND|XCB_GC_LINE_WIDTH|XCB_GC_SUBWINDOW_MODE, v);
+        xcb_poly_rectangle(dis, screen->root, gc, 1, &(xcb_rectangle_t){ gx + b/2, gy + b/2, gw + b, gh + b });
+    }
+
+    xcb_generic_event_t *e = NULL;
+    xcb_motion_notify_event_t *ev = NULL;
+    bool ungrab = false, failed = false, watched = watching, armed = watcharmed;
+    watching = 0; /* waiting for the user to drag is no stall */
+    watcharm(false);
+    do {
+        if (e) free(e);
+        xcb_flush(dis);
+        while(!(e = xcb_wait_for_event(dis))) xcb_flush(dis);
+        if (grab) {
+            xcb_grab_pointer_reply_t *reply = NULL;
+            xcb_generic_error_t *error = NULL;
+            if (xcb_poll_for_reply(dis, grab, (void**)&reply, &error)) {
+                failed = !reply || reply->status != XCB_GRAB_STATUS_SUCCESS;
+                free(reply); free(error); grab = 0;
+            }
+        }
+        if (failed) break;
+        switch (e->response_type & ~0x80) {
+            case XCB_CONFIGURE_REQUEST: case XCB_MAP_REQUEST:
+                events[e->response_type & ~0x80](e);
+                break;
+            case XCB_MOTION_NOTIFY:
+                ev = (xcb_motion_notify_event_t*)e;
+                xw = (mode == MOVE ? winx : winw) + ev->root_x - mx;
+                yh = (mode == MOVE ? winy : winh) + ev->root_y - my;
+                if (outline) xcb_poly_rectangle(dis, screen->root, gc, 1, &(xcb_rectangle_t){ gx + b/2, gy + b/2, gw + b, gh + b });
+                if (mode == RESIZE) { gw = xw>MINWSZ?xw:winw; gh = yh>MINWSZ?yh:winh; }
+                else if (mode == MOVE) { gx = xw; gy = yh; }
+                if (outline) xcb_poly_rectangle(dis, screen->root, gc, 1, &(xcb_rectangle_t){ gx + b/2, gy + b/2, gw + b, gh + b });
+                else { moveresize(current, gx, gy, gw, gh); commit(); }
+                xcb_flush(dis);
+                break;
+            case XCB_KEY_PRESS:
+            case XCB_KEY_RELEASE:
+            case XCB_BUTTON_PRESS:
+            case XCB_BUTTON_RELEASE:
+                ungrab = true;
+                break;
+            default:
+                if (hassync && events[e->response_type & ~0x80] == syncnotify) { syncnotify(e); commit(); }
+        }
+    } while(!ungrab && current);
+    if (outline) {
+        xcb_poly_rectangle(dis, screen->root, gc, 1, &(xcb_rectangle_t){ gx + b/2, gy + b/2, gw + b, gh + b });
+        xcb_free_gc(dis, gc);
+        xcb_ungrab_server(dis);
+        if (current && !failed) moveresize(current, gx, gy, gw, gh);
+    }
+    if (failed && current == c) {
+        c->isfloating = floating;
+        if (fullscrn) setfullscreen(c, True);
+        tile();
+    }
+    if (grab) xcb_discard_reply(dis, grab);
+    if (watched) watchbegin(watchtype, watchwin);
+    if (armed) watcharm(true);
+    DEBUG("xcb: ungrab");
+    xcb_ungrab_pointer(dis, XCB_CURRENT_TIME);
+    if (failed && !xcb_ignored(e) && events[e->response_type & ~0x80]) events[e->response_type & ~0x80](e);
+    free(e);
+}
+
+/* start a drag with the replies to mousemotion(), if the pointer was
+ * grabbed and the window is still the current one. the cookie's data is
+ * the drag mode itself, not the binding's argument, which a reload of
+ * the configuration may free while the replies are pending */
+void dragstart(cookie *r) {
+    xcb_get_geometry_reply_t  *geometry = r->reply[0];
+    xcb_query_pointer_reply_t *pointer = r->reply[1];
+    xcb_grab_pointer_reply_t  *grab = r->reply[2];
+
+    if (!grab || grab->status != XCB_GRAB_STATUS_SUCCESS) return;
+    if (!geometry || !pointer || !current || current->win != r->win) {
+        xcb_ungrab_pointer(dis, XCB_CURRENT_TIME);
+        return;
+    }
+    drag(&(Arg){.i = (intptr_t)r->data}, pointer->root_x, pointer->root_y, geometry->x, geometry->y, geometry->width, geometry->height, 0);
+}
+
 /* when the mouse enters a window's borders
  * the window, if notifying of such events (EnterWindowMask)
  * will notify the wm and will get focus */
@@ -515,6 +1224,75 @@ void enternotify(xcb_generic_event_t *e) {
     if (c && ev->mode == XCB_NOTIFY_MODE_NORMAL && ev->detail != XCB_NOTIFY_DETAIL_INFERIOR) update_current(c);
 }
 
+/* add a record to the flight recorder, overwriting the oldest. there is
+ * a single writer, a dump from a signal handler can at worst catch the
+ * newest record half written */
+void flight(unsigned int kind, unsigned int detail, xcb_window_t win, uint32_t value) {
+    flightlog[flightpos % FLIGHTRECS] = (flightrec){ (uint64_t)((msnow() - tstart) * 1000), kind, detail, win, value };
+    flightpos++;
+}
+
+/* write the flight recorder to FLIGHT_FILE, suffixed with the pid, and
+ * tell so on standard error. the file is the magic, the number of records
+ * and the records, oldest first. only async-signal-safe calls are made,
+ * for crash(). the path is predictable, so a previous dump is removed and
+ * the file created anew, never following a link or opening a file planted
+ * there. fails if there is nothing recorded or on write errors */
+bool flightdump(void) {
+    static const char msg[] = "monsterwm: flight recorder dumped to ";
+    unsigned int pos = flightpos, n = pos < FLIGHTRECS ? pos:FLIGHTRECS, first = (pos - n) % FLIGHTRECS;
+    unsigned int k = n < FLIGHTRECS - first ? n:FLIGHTRECS - first;
+    uint32_t count = n;
+    bool ok;
+    int fd;
+
+    if (!n || !flightpath[0]) return false;
+    unlink(flightpath);
+    if ((fd = open(flightpath, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC, 0600)) == -1) return false;
+    ok = write(fd, FLIGHTMAGIC, sizeof(FLIGHTMAGIC) - 1) == sizeof(FLIGHTMAGIC) - 1
+      && write(fd, &count, sizeof(count)) == sizeof(count)
+      && write(fd, flightlog + first, k * sizeof(flightrec)) == (ssize_t)(k * sizeof(flightrec))
+      && write(fd, flightlog, (n - k) * sizeof(flightrec)) == (ssize_t)((n - k) * sizeof(flightrec));
+    close(fd);
+    return ok && write(STDERR_FILENO, msg, sizeof(msg) - 1) > 0
+              && write(STDERR_FILENO, flightpath, strlen(flightpath)) > 0 && write(STDERR_FILENO, "\n", 1) > 0;
+}
+
+/* print a dump of the flight recorder, one record per line: the time in
+ * ms, the kind, detail, window and value, see flightrec */
+void flightprint(const char *path) {
+    char magic[sizeof(FLIGHTMAGIC) - 1];
+    uint32_t n;
+    flightrec f;
+    FILE *file;
+
+    if (!(file = fopen(path, "rb"))) err(EXIT_FAILURE, "cannot open %s", path);
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, FLIGHTMAGIC, sizeof(magic))
+            || fread(&n, sizeof(n), 1, file) != 1)
+        errx(EXIT_FAILURE, "error: %s is not a flight recorder dump\n", path);
+    for (; n-- && fread(&f, sizeof(f), 1, file) == 1;)
+        printf("%12.3f %-9s %5u 0x%08x %u\n", f.time / 1000.0, f.kind < FL_KINDS ? flightkinds[f.kind]:"?", f.detail, f.win, f.value);
+    fclose(file);
+}
+
+/* write the pending status snapshots to standard output for as long
+ * as it does not block, a slow reader must not stall the wm. if the
+ * reader went away the snapshots are discarded */
+void flushinfo(void) {
+    struct pollfd fd = { .fd = STDOUT_FILENO, .events = POLLOUT };
+    for (ssize_t r;;) {
+        if (statusoff == statuslen[0]) {
+            if (!statuslen[1]) return;
+            memcpy(status[0], status[1], statuslen[0] = statuslen[1]);
+            statuslen[1] = statusoff = 0;
+        }
+        if (poll(&fd, 1, 0) <= 0 || fd.revents & (POLLERR|POLLHUP|POLLNVAL)) break;
+        if ((r = write(STDOUT_FILENO, status[0] + statusoff, statuslen[0] - statusoff)) > 0) statusoff += r;
+        else if (errno != EINTR && errno != EAGAIN) break;
+    }
+    if (fd.revents & (POLLERR|POLLHUP|POLLNVAL)) statuslen[0] = statuslen[1] = statusoff = 0;
+}
+
 /* find and focus the client which received
  * the urgent hint in the current desktop */
 void focusurgent() {
@@ -527,157 +1305,323 @@ void focusurgent() {
     if (c) { change_desktop(&(Arg){.i = --d}); update_current(c); }
 }
 
+/* release what readconfig() allocated for a configuration */
+void freeconfig(config *c) {
+    free(c->text); free(c->args);
+    free(c->keys); free(c->buttons); free(c->rules);
+}
+
 /* get a pixel with the requested color
- * to fill some window area - borders */
-unsigned int getcolor(char* color) {
-    xcb_colormap_t map = screen->default_colormap;
-    xcb_alloc_color_reply_t *c;
-    unsigned int r, g, b, rgb, pixel;
-
-    rgb = xcb_get_colorpixel(color);
-    r = rgb >> 16; g = rgb >> 8 & 0xFF; b = rgb & 0xFF;
-    c = xcb_alloc_color_reply(dis, xcb_alloc_color(dis, map, r * 257, g * 257, b * 257), NULL);
-    if (!c)
-        errx(EXIT_FAILURE, "error: cannot allocate color '%s'\n", color);
-
-    pixel = c->pixel; free(c);
-    return pixel;
+ * to fill some window area - borders
+ * on TrueColor visuals the pixel is computed right away, else
+ * a color is allocated and the pixel stored once the reply arrives */
+void getcolor(char* color, unsigned int *pixel) {
+    unsigned int rgb = xcb_get_colorpixel(color), r = rgb >> 16, g = rgb >> 8 & 0xFF, b = rgb & 0xFF;
+    xcb_visualtype_t *visual = xcb_root_visual();
+    if (visual && visual->_class == XCB_VISUAL_CLASS_TRUE_COLOR) { *pixel = xcb_truecolor_pixel(visual, rgb); return; }
+    xcb_async(XCB_NONE, pixel, setcolor, 1,
+            xcb_alloc_color(dis, screen->default_colormap, r * 257, g * 257, b * 257).sequence);
+}
+
+/* grab the binded buttons once on the root window, so clicks on any
+ * client are reported without grabs per client. with CLICK_TO_FOCUS
+ * all buttons are grabbed synchronously so clicks can be replayed */
+void grabbuttons(void) {
+    unsigned int modifiers[] = { 0, XCB_MOD_MASK_LOCK, numlockmask, numlockmask|XCB_MOD_MASK_LOCK };
+    xcb_ungrab_button(dis, XCB_BUTTON_INDEX_ANY, screen->root, XCB_MOD_MASK_ANY);
+    if (CLICK_TO_FOCUS)
+        xcb_grab_button(dis, 0, screen->root, XCB_EVENT_MASK_BUTTON_PRESS, XCB_GRAB_MODE_SYNC, XCB_GRAB_MODE_ASYNC,
+                XCB_WINDOW_NONE, XCB_CURSOR_NONE, XCB_BUTTON_INDEX_ANY, XCB_MOD_MASK_ANY);
+    else for (unsigned int b=0; b<cfg.nbuttons; b++)
+        for (unsigned int m=0; m<LENGTH(modifiers); m++)
+            xcb_grab_button(dis, 0, screen->root, XCB_EVENT_MASK_BUTTON_PRESS, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC,
+                    XCB_WINDOW_NONE, XCB_CURSOR_NONE, cfg.buttons[b].button, cfg.buttons[b].mask|modifiers[m]);
 }
 
-/* set the given client to listen to button events (presses / releases) */
-void grabbuttons(client *c) {
+/* grab or ungrab the keycodes of a key binding, with any lock modifier */
+void grabkey(const key *k, bool grab) {
+    xcb_keycode_t *keycode;
     unsigned int modifiers[] = { 0, XCB_MOD_MASK_LOCK, numlockmask, numlockmask|XCB_MOD_MASK_LOCK };
-    xcb_ungrab_button(dis, XCB_BUTTON_INDEX_ANY, c->win, XCB_GRAB_ANY);
-    for (unsigned int b=0; b<LENGTH(buttons); b++)
+    if (!(keycode = xcb_get_keycodes(k->keysym))) return;
+    for (unsigned int i=0; keycode[i] != XCB_NO_SYMBOL; i++)
         for (unsigned int m=0; m<LENGTH(modifiers); m++)
-            if (CLICK_TO_FOCUS)
-                xcb_grab_button(dis, 1, c->win, XCB_EVENT_MASK_BUTTON_PRESS, XCB_GRAB_MODE_SYNC, XCB_GRAB_MODE_ASYNC,
-                        XCB_WINDOW_NONE, XCB_CURSOR_NONE, XCB_BUTTON_INDEX_ANY, XCB_BUTTON_MASK_ANY);
-            else
-                xcb_grab_button(dis, 1, c->win, XCB_EVENT_MASK_BUTTON_PRESS, XCB_GRAB_MODE_SYNC, XCB_GRAB_MODE_ASYNC,
-                        XCB_WINDOW_NONE, XCB_CURSOR_NONE, buttons[b].button, buttons[b].mask|modifiers[m]);
+            if (grab) xcb_grab_key(dis, 1, screen->root, k->mod | modifiers[m], keycode[i], XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+            else xcb_ungrab_key(dis, keycode[i], screen->root, k->mod | modifiers[m]);
+    free(keycode);
 }
 
 /* the wm should listen to key presses */
 void grabkeys(void) {
-    xcb_keycode_t *keycode;
-    unsigned int modifiers[] = { 0, XCB_MOD_MASK_LOCK, numlockmask, numlockmask|XCB_MOD_MASK_LOCK };
     xcb_ungrab_key(dis, XCB_GRAB_ANY, screen->root, XCB_MOD_MASK_ANY);
-    for (unsigned int i=0; i<LENGTH(keys); i++) {
-        keycode = xcb_get_keycodes(keys[i].keysym);
-        for (unsigned int k=0; keycode[k] != XCB_NO_SYMBOL; k++)
-            for (unsigned int m=0; m<LENGTH(modifiers); m++)
-                xcb_grab_key(dis, 1, screen->root, keys[i].mod | modifiers[m], keycode[k], XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
-    }
+    for (unsigned int i=0; i<cfg.nkeys; i++) if (cfg.keys[i].func) grabkey(&cfg.keys[i], true);
 }
 
 /* arrange windows in a grid */
 void grid(int hh, int cy) {
     int n = 0, cols = 0, cn = 0, rn = 0, i = -1;
     for (client *c = head; c; c=c->next) if (!ISFFT(c)) ++n;
+    PROBE2(layout, mode, n)
     for (cols=0; cols <= n/2; cols++) if (cols*cols >= n) break; /* emulate square root */
     if (n == 5) cols = 2;
 
-    int rows = n/cols, ch = hh - BORDER_WIDTH, cw = (ww - BORDER_WIDTH)/(cols?cols:1);
+    int rows = n/cols, ch = hh - cfg.borderwidth, cw = (ww - cfg.borderwidth)/(cols?cols:1);
     for (client *c=head; c; c=c->next) {
         if (ISFFT(c)) continue; else ++i;
         if (i/rows + 1 > cols - n%cols) rows = n/cols + 1;
-        xcb_move_resize(dis, c->win, cn*cw, cy + rn*ch/rows, cw - BORDER_WIDTH, ch/rows - BORDER_WIDTH);
+        moveresize(c, cn*cw, cy + rn*ch/rows, cw - cfg.borderwidth, ch/rows - cfg.borderwidth);
         if (++rn >= rows) { rn = 0; cn++; }
     }
 }
 
+/* the name of the handler of an event type, or of reply callbacks for
+ * REPLY. it is safe to call from a signal handler */
+const char* handlername(unsigned int type) {
+    switch (type) {
+        case 0:                       return "xerror";
+        case XCB_KEY_PRESS:           return "keypress";
+        case XCB_BUTTON_PRESS:        return "buttonpress";
+        case XCB_ENTER_NOTIFY:        return "enternotify";
+        case XCB_DESTROY_NOTIFY:      return "destroynotify";
+        case XCB_UNMAP_NOTIFY:        return "unmapnotify";
+        case XCB_MAP_REQUEST:         return "maprequest";
+        case XCB_CONFIGURE_REQUEST:   return "configurerequest";
+        case XCB_PROPERTY_NOTIFY:     return "propertynotify";
+        case XCB_CLIENT_MESSAGE:      return "clientmessage";
+        case XCB_MAPPING_NOTIFY:      return "mappingnotify";
+        case REPLY:                   return "reply";
+        default: return type < LENGTH(events) && events[type] == syncnotify ? "syncnotify" : "other";
+    }
+}
+
+/* add, remove or toggle, as action is 1, 0 or 2, an atom of the
+ * client's _NET_WM_STATE that the wm doesn't manage itself, such as
+ * _NET_WM_STATE_ABOVE or _NET_WM_STATE_SKIP_TASKBAR, so that
+ * setclientstate() publishes it along with the wm's own atoms */
+void keepstate(client *c, xcb_atom_t atom, unsigned int action) {
+    if (!atom || atom == netatoms[NET_FULLSCREEN] || atom == netatoms[NET_HIDDEN] || atom == netatoms[NET_FOCUSED]) return;
+    unsigned int i = 0;
+    while (i < c->nstates && c->states[i] != atom) i++;
+    bool set = i < c->nstates, on = action == 1 || (action == 2 && !set);
+    if (on == set || (on && c->nstates == MAXSTATES)) return;
+    if (on) c->states[c->nstates++] = atom; else c->states[i] = c->states[--c->nstates];
+    if (c->state == -1) return;
+    int state = c->state;
+    c->state = -1;
+    setclientstate(c, state & STATE_HIDDEN, state & STATE_FOCUSED);
+}
+
 /* on the press of a key check to see if there's a binded function to call */
 void keypress(xcb_generic_event_t *e) {
     xcb_key_press_event_t *ev       = (xcb_key_press_event_t *)e;
     xcb_keysym_t           keysym   = xcb_get_keysym(ev->detail);
     DEBUGP("xcb: keypress: code: %d mod: %d\n", ev->detail, ev->state);
-    for (unsigned int i=0; i<LENGTH(keys); i++)
-        if (keysym == keys[i].keysym && CLEANMASK(keys[i].mod) == CLEANMASK(ev->state) && keys[i].func)
-                keys[i].func(&keys[i].arg);
+    for (unsigned int i=0; i<cfg.nkeys; i++)
+        if (keysym == cfg.keys[i].keysym && CLEANMASK(cfg.keys[i].mod) == CLEANMASK(ev->state) && cfg.keys[i].func) {
+            if (cfg.keys[i].repeat && presses > 1)
+                cfg.keys[i].func(&(Arg){.i = (cfg.keys[i].arg.i ? cfg.keys[i].arg.i:1) * (int)presses});
+            else cfg.keys[i].func(&cfg.keys[i].arg);
+        }
 }
 
 /* explicitly kill a client - close the highlighted window
- * send a delete message and remove the client */
+ * ask for the supported protocols and remove the client,
+ * killwindow sends the delete message or kills the window */
 void killclient() {
     if (!current) return;
-    xcb_icccm_get_wm_protocols_reply_t reply; unsigned int n = 0; bool got = false;
-    if (xcb_icccm_get_wm_protocols_reply(dis,
-        xcb_icccm_get_wm_protocols(dis, current->win, wmatoms[WM_PROTOCOLS]),
-        &reply, NULL)) { /* TODO: Handle error? */
-        for(; n != reply.atoms_len; ++n) if ((got = reply.atoms[n] == wmatoms[WM_DELETE_WINDOW])) break;
-        xcb_icccm_get_wm_protocols_reply_wipe(&reply);
-    }
-    if (got) deletewindow(current->win);
-    else xcb_kill_client(dis, current->win);
+    xcb_async(current->win, NULL, killwindow, 1,
+            xcb_icccm_get_wm_protocols(dis, current->win, wmatoms[WM_PROTOCOLS]).sequence);
     removeclient(current);
 }
 
+/* send a delete message if the window supports it, else kill it */
+void killwindow(cookie *r) {
+    xcb_icccm_get_wm_protocols_reply_t reply; bool got = false;
+    if (r->reply[0] && xcb_icccm_get_wm_protocols_from_reply(r->reply[0], &reply))
+        for (unsigned int n=0; n != reply.atoms_len; ++n) if ((got = reply.atoms[n] == wmatoms[WM_DELETE_WINDOW])) break;
+    if (got) deletewindow(r->win);
+    else xcb_kill_client(dis, r->win);
+}
+
 /* focus the previously focused desktop */
 void last_desktop() {
     change_desktop(&(Arg){.i = previous_desktop});
 }
 
-/* a map request is received when a window wants to display itself
+/* execute a command and return its pid, or 0 if it could not be run
+ * posix_spawn returns once the command is executed, how long that
+ * takes is accounted as the launch latency. the child runs in its
+ * own session, away from the wm's terminal, with the default signal
+ * mask. a libc without POSIX_SPAWN_SETSID gives it its own process
+ * group only */
+pid_t launch(const char **com) {
+    extern char **environ;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    double t = msnow();
+    pid_t pid;
+    int e;
+
+    sigemptyset(&mask);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &mask);
+#ifdef POSIX_SPAWN_SETSID
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSID);
+#else
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETPGROUP);
+#endif
+    e = posix_spawnp(&pid, com[0], NULL, &attr, (char**)com, environ);
+    posix_spawnattr_destroy(&attr);
+    if (e) { fprintf(stderr, "error: execvp %s failed: %s\n", com[0], strerror(e)); return 0; }
+
+    t = msnow() - t;
+    tlaunch += t; nlaunch++;
+    if (t > tlaunchmax) tlaunchmax = t;
+    return pid;
+}
+
+/* read the configuration file again and apply only what changed, in
+ * one go: keys no longer bound are ungrabbed and new ones grabbed, the
+ * buttons grabbed again, the borders recolored and the desktops tiled
+ * again if a setting they depend on changed. clients stay mapped, and
+ * commit() sends only the geometry that differs */
+void loadconfig(void) {
+    config old = cfg, new;
+    unsigned int focus = win_focus, unfocus = win_unfocus, i, j;
+    if (!readconfig(&new)) return;
+    cfg = new;
+
+    for (i=0; i<old.nkeys; i++) {
+        for (j=0; j<cfg.nkeys && !(cfg.keys[j].func && cfg.keys[j].mod == old.keys[i].mod
+                                   && cfg.keys[j].keysym == old.keys[i].keysym); j++);
+        if (old.keys[i].func && j == cfg.nkeys) grabkey(&old.keys[i], false);
+    }
+    for (i=0; i<cfg.nkeys; i++) {
+        for (j=0; j<old.nkeys && !(old.keys[j].func && old.keys[j].mod == cfg.keys[i].mod
+                                   && old.keys[j].keysym == cfg.keys[i].keysym); j++);
+        if (cfg.keys[i].func && j == old.nkeys) grabkey(&cfg.keys[i], true);
+    }
+    for (i=0, j=old.nbuttons == cfg.nbuttons; j && i<cfg.nbuttons; i++)
+        j = old.buttons[i].mask == cfg.buttons[i].mask && old.buttons[i].button == cfg.buttons[i].button;
+    if (!j) grabbuttons();
+
+    if (strcmp(old.focus, cfg.focus)) getcolor(cfg.focus, &win_focus);
+    if (strcmp(old.unfocus, cfg.unfocus)) getcolor(cfg.unfocus, &win_unfocus);
+    if (focus != win_focus || unfocus != win_unfocus) recolor();
+
+    if (old.mastersize != cfg.mastersize || old.borderwidth != cfg.borderwidth || old.panelheight != cfg.panelheight) {
+        int cd = current_desktop;
+        wh = screen->height_in_pixels - cfg.panelheight;
+        for (int d=0; d<DESKTOPS; d++) { select_desktop(d); tile(); }
+        select_desktop(cd);
+    }
+    freeconfig(&old);
+}
+
+/* find the value of a name of the configuration file, of the kind
+ * m for modifiers, k for keys, b for buttons and a for arguments */
+bool lookup(char kind, const char *name, unsigned int *value) {
+    static const struct { char kind; const char *name; unsigned int value; } names[] = {
+        { 'm', "Mod1", Mod1Mask }, { 'm', "Mod4", Mod4Mask }, { 'm', "Shift", ShiftMask }, { 'm', "Control", ControlMask },
+        { 'k', "Return", XK_Return }, { 'k', "Tab", XK_Tab }, { 'k', "BackSpace", XK_BackSpace }, { 'k', "Escape", XK_Escape },
+        { 'k', "space", XK_space }, { 'k', "grave", XK_grave }, { 'k', "Delete", XK_Delete }, { 'k', "Home", XK_Home },
+        { 'k', "End", XK_End }, { 'k', "Prior", XK_Prior }, { 'k', "Next", XK_Next }, { 'k', "Left", XK_Left },
+        { 'k', "Right", XK_Right }, { 'k', "Up", XK_Up }, { 'k', "Down", XK_Down },
+        { 'b', "Button1", Button1 }, { 'b', "Button2", Button2 }, { 'b', "Button3", Button3 },
+        { 'b', "Button4", Button4 }, { 'b', "Button5", Button5 },
+        { 'a', "tile", TILE }, { 'a', "monocle", MONOCLE }, { 'a', "bstack", BSTACK }, { 'a', "grid", GRID },
+        { 'a', "move", MOVE }, { 'a', "resize", RESIZE }, { 'a', "outline_move", MOVE|OUTLINE },
+        { 'a', "outline_resize", RESIZE|OUTLINE },
+    };
+    for (unsigned int i=0; i<LENGTH(names); i++)
+        if (names[i].kind == kind && !strcmp(names[i].name, name)) { *value = names[i].value; return true; }
+    return false;
+}
+
+/* manage a window that requested to be mapped
  * if the window has override_redirect flag set then it should not be handled
- * by the wm. if the window already has a client then there is nothing to do.
+ * by the wm. if the window got a client meanwhile there is nothing to do.
  *
  * get the window class and name instance and try to match against an app rule.
  * create a client for the window, that client will always be current.
  * check for transient state, and fullscreen state and the appropriate values.
  * if the desktop in which the window was spawned is the current desktop then
  * display the window, else, if set, focus the new desktop.
+ *
+ * the first window of the scratchpad class is not managed, it is placed
+ * and left unmapped for togglescratch() to show.
  */
-void maprequest(xcb_generic_event_t *e) {
-    xcb_map_request_event_t            *ev = (xcb_map_request_event_t*)e;
-    xcb_window_t                       windows[] = { ev->window }, transient = 0;
-    xcb_get_window_attributes_reply_t  *attr[1];
+void manage(cookie *r) {
+    xcb_get_window_attributes_reply_t  *attr = r->reply[0];
+    xcb_get_property_reply_t           *prop_reply = r->reply[3];
     xcb_icccm_get_wm_class_reply_t     ch;
-    xcb_get_geometry_reply_t           *geometry;
-    xcb_get_property_reply_t           *prop_reply;
+    xcb_icccm_get_wm_protocols_reply_t protocols;
+    xcb_window_t                       transient = 0;
 
-    xcb_get_attributes(windows, attr, 1);
-    if (!attr[0] || attr[0]->override_redirect) return;
-    if (wintoclient(ev->window)) return;
-    DEBUG("xcb: map request");
+    if (!attr || attr->override_redirect) return;
+    if (r->win == scratch || wintoclient(r->win)) return;
 
-    bool follow = false, floating = false;
+    bool follow = false, floating = false, freeze = false;
     int cd = current_desktop, newdsk = current_desktop;
-    if (xcb_icccm_get_wm_class_reply(dis, xcb_icccm_get_wm_class(dis, ev->window), &ch, NULL)) { /* TODO: error handling */
+    if (r->reply[1] && xcb_icccm_get_wm_class_from_reply(&ch, r->reply[1])) {
         DEBUGP("class: %s instance: %s\n", ch.class_name, ch.instance_name);
-        for (unsigned int i=0; i<LENGTH(rules); i++)
-            if (strstr(ch.class_name, rules[i].class) || strstr(ch.instance_name, rules[i].class)) {
-                follow = rules[i].follow;
-                newdsk = (rules[i].desktop < 0) ? current_desktop:rules[i].desktop;
-                floating = rules[i].floating;
+        if (!scratch && (!strcmp(ch.class_name, SCRATCH_CLASS) || !strcmp(ch.instance_name, SCRATCH_CLASS))) {
+            unsigned int v[] = { ww/6, TOP_PANEL ? cfg.panelheight:0, ww*2/3, wh/2, cfg.borderwidth };
+            xcb_configure_window(dis, (scratch = r->win), XCB_MOVE_RESIZE|XCB_BORDER, v);
+            xcb_change_window_attributes(dis, scratch, XCB_CW_BORDER_PIXEL, &win_focus);
+            return;
+        }
+        for (unsigned int i=0; i<cfg.nrules; i++)
+            if (strstr(ch.class_name, cfg.rules[i].class) || strstr(ch.instance_name, cfg.rules[i].class)) {
+                follow = cfg.rules[i].follow;
+                newdsk = (cfg.rules[i].desktop < 0) ? current_desktop:cfg.rules[i].desktop;
+                floating = cfg.rules[i].floating;
+                freeze = cfg.rules[i].freeze;
                 break;
             }
-        xcb_icccm_get_wm_class_reply_wipe(&ch);
-    }
-
-    /* might be useful in future */
-    if ((geometry = xcb_get_geometry_reply(dis, xcb_get_geometry(dis, ev->window), NULL))) { /* TODO: error handling */
-        DEBUGP("geom: %ux%u+%d+%d\n", geometry->width, geometry->height,
-                                      geometry->x,     geometry->y);
-        free(geometry);
     }
 
     if (cd != newdsk) select_desktop(newdsk);
-    client *c = addwindow(ev->window);
+    client *c = addwindow(r->win);
+    clientlist(c->win, true);
+    xcb_change_property(dis, XCB_PROP_MODE_REPLACE, c->win, netatoms[NET_WM_DESKTOP], XCB_ATOM_CARDINAL, 32, 1, &newdsk);
 
-    xcb_icccm_get_wm_transient_for_reply(dis, xcb_icccm_get_wm_transient_for_unchecked(dis, ev->window), &transient, NULL); /* TODO: error handling */
+    if (r->reply[2]) xcb_icccm_get_wm_transient_for_from_reply(&transient, r->reply[2]);
     c->istransient = transient?true:false;
     c->isfloating  = floating || c->istransient;
 
-    prop_reply  = xcb_get_property_reply(dis, xcb_get_property_unchecked(dis, 0, ev->window, netatoms[NET_WM_STATE], XCB_ATOM_ATOM, 0, 1), NULL); /* TODO: error handling */
-    if (prop_reply) {
-        if (prop_reply->format == 32) {
-            xcb_atom_t *v = xcb_get_property_value(prop_reply);
-            for (unsigned int i=0; i<prop_reply->value_len; i++)
-                DEBUGP("%d : %d\n", i, v[0]);
-            setfullscreen(c, (v[0] == netatoms[NET_FULLSCREEN]));
+    /* move the window's process to the group of its desktop, a pid
+     * is only meaningful if the window runs on this machine */
+    xcb_get_property_reply_t *machine = r->reply[7];
+    if (r->reply[6] && ((xcb_get_property_reply_t*)r->reply[6])->format == 32
+                    && xcb_get_property_value_length(r->reply[6]) >= 4
+                    && machine && machine->format == 8 && xcb_get_property_value_length(machine) == (int)strlen(host.nodename)
+                    && !memcmp(xcb_get_property_value(machine), host.nodename, strlen(host.nodename))) {
+        c->pid = *(uint32_t*)xcb_get_property_value(r->reply[6]);
+        c->freeze = freeze;
+        cgwrite(newdsk, c->freeze, "cgroup.procs", "%d", c->pid);
+    }
+
+    /* watch the sync counter of clients that support _NET_WM_SYNC_REQUEST */
+    if (hassync && r->reply[4] && r->reply[5] && xcb_icccm_get_wm_protocols_from_reply(r->reply[4], &protocols)
+                && ((xcb_get_property_reply_t*)r->reply[5])->format == 32 && xcb_get_property_value_length(r->reply[5]) >= 4)
+        for (unsigned int i=0; i<protocols.atoms_len; i++) if (protocols.atoms[i] == netatoms[NET_SYNC]) {
+            unsigned int values[] = { *(xcb_sync_counter_t*)xcb_get_property_value(r->reply[5]), XCB_SYNC_VALUETYPE_ABSOLUTE,
+                                      0, 0, XCB_SYNC_TESTTYPE_POSITIVE_COMPARISON, 1 };
+            xcb_sync_create_alarm(dis, (c->alarm = xcb_generate_id(dis)), XCB_SYNC_CA_COUNTER|XCB_SYNC_CA_VALUE_TYPE|
+                    XCB_SYNC_CA_VALUE|XCB_SYNC_CA_TEST_TYPE|XCB_SYNC_CA_EVENTS, values);
+            break;
         }
-        free(prop_reply);
+
+    /* keep the state atoms the client set before mapping */
+    if (prop_reply && prop_reply->format == 32) {
+        xcb_atom_t *v = xcb_get_property_value(prop_reply);
+        bool fullscrn = false;
+        for (unsigned int i=0; i<prop_reply->value_len; i++) {
+            DEBUGP("%d : %d\n", i, v[i]);
+            if (v[i] == netatoms[NET_FULLSCREEN]) fullscrn = true; else keepstate(c, v[i], 1);
+        }
+        setfullscreen(c, fullscrn);
     }
 
     /** information for stdout **/
@@ -685,21 +1629,61 @@ void maprequest(xcb_generic_event_t *e) {
     DEBUGP("floating:  %d\n", c->isfloating);
 
     if (cd != newdsk) select_desktop(cd);
-    if (cd == newdsk) { tile(); xcb_map_window(dis, c->win); update_current(c); }
+    if (cd == newdsk) { tile(); commit(); if (!c->isiconic) xcb_map(dis, c->win); update_current(c); }
     else if (follow) { change_desktop(&(Arg){.i = newdsk}); update_current(c); }
-    grabbuttons(c);
+    else setclientstate(c, true, false);
 
     desktopinfo();
 }
 
+/* the keyboard mapping changed, refresh the key symbols
+ * and grab the keys again as their keycodes might differ */
+void mappingnotify(xcb_generic_event_t *e) {
+    xcb_mapping_notify_event_t *ev = (xcb_mapping_notify_event_t*)e;
+    if (!keysyms || ev->request == XCB_MAPPING_POINTER) return;
+    xcb_refresh_keyboard_mapping(keysyms, ev);
+    if (ev->request == XCB_MAPPING_KEYBOARD) grabkeys();
+}
+
+/* a map request is received when a window wants to display itself
+ * if the window already has a client it unmapped itself and wants to be
+ * shown again, it is mapped if its desktop is the visible one and the
+ * layout shows it, else it is when the layout or desktop changes.
+ *
+ * ask for the window attributes, class and name instance, transient
+ * and fullscreen state, protocols, sync counter, pid and client machine
+ * all at once, manage() handles the replies when they arrive, so a slow
+ * client can not stall the wm.
+ */
+void maprequest(xcb_generic_event_t *e) {
+    xcb_map_request_event_t *ev = (xcb_map_request_event_t*)e;
+    client *c = wintoclient(ev->window), *t = head;
+    if (c) {
+        while (t && t != c) t = t->next;
+        if (t && !c->isiconic) xcb_map(dis, c->win);
+        return;
+    }
+    DEBUG("xcb: map request");
+    xcb_get_window_attributes_cookie_t attr = xcb_get_window_attributes(dis, ev->window);
+    xcb_get_property_cookie_t          wmclass = xcb_icccm_get_wm_class(dis, ev->window);
+    xcb_get_property_cookie_t          transient = xcb_icccm_get_wm_transient_for(dis, ev->window);
+    xcb_get_property_cookie_t          state = xcb_get_property(dis, 0, ev->window, netatoms[NET_WM_STATE], XCB_ATOM_ATOM, 0, MAXSTATES + 3);
+    xcb_get_property_cookie_t          protocols = xcb_icccm_get_wm_protocols(dis, ev->window, wmatoms[WM_PROTOCOLS]);
+    xcb_get_property_cookie_t          counter = xcb_get_property(dis, 0, ev->window, netatoms[NET_SYNC_COUNTER], XCB_ATOM_CARDINAL, 0, 1);
+    xcb_get_property_cookie_t          pid = xcb_get_property(dis, 0, ev->window, netatoms[NET_WM_PID], XCB_ATOM_CARDINAL, 0, 1);
+    xcb_get_property_cookie_t          machine = xcb_icccm_get_wm_client_machine(dis, ev->window);
+    xcb_async(ev->window, NULL, manage, 8, attr.sequence, wmclass.sequence, transient.sequence, state.sequence,
+                                           protocols.sequence, counter.sequence, pid.sequence, machine.sequence);
+}
+
 /* move the mouse pointer to the rightmost screen edge */
 void mouse_aside() {
     xcb_query_pointer_reply_t	*reply = NULL;
+    xcb_query_pointer_cookie_t  pointer = xcb_query_pointer(dis, screen->root);
     int16_t                     rel_x = 0, rel_y = 0;
 
-    reply = xcb_query_pointer_reply(dis,
-                                    xcb_query_pointer(dis, screen->root),
-                                    NULL);
+    flight(FL_WAIT, XCB_QUERY_POINTER, screen->root, pointer.sequence);
+    reply = xcb_query_pointer_reply(dis, pointer, NULL);
     if (reply) {
         rel_x = ww - reply->root_x;
         DEBUGP("%s: warp relative pos (%d,%d)\n", __func__, rel_x, rel_y);
@@ -707,79 +1691,45 @@ void mouse_aside() {
                          XCB_NONE, XCB_NONE,
                          0, 0, 0, 0,
                          rel_x, rel_y);
+        free(reply);
     } else {
         DEBUGP("%s: no mouse query info\n", __func__);
     }
 }
 
-/* grab the pointer and get it's current position
+/* grab the pointer and move or resize the current window with it
  * all pointer movement events will be reported until it's ungrabbed
- * until the mouse button has not been released,
- * grab the interesting events - button press/release and pointer motion
- * and on on pointer movement resize or move the window under the curson.
- * if the received event is a map request or a configure request call the
- * appropriate handler, and stop listening for other events.
- * Ungrab the poitner and event handling is passed back to run() function.
- * Once a window has been moved or resized, it's marked as floating. */
+ * from a button press, with the window's geometry known, drag() starts
+ * at once from the press's position, the grab's reply is checked while
+ * dragging. else the geometry, pointer and grab requests are sent
+ * together and dragstart() starts once their replies arrive. */
 void mousemotion(const Arg *arg) {
-    xcb_get_geometry_reply_t  *geometry;
-    xcb_query_pointer_reply_t *pointer;
-    xcb_grab_pointer_reply_t  *grab_reply;
-    int mx, my, winx, winy, winw, winh, xw, yh;
-
     if (!current) return;
-    geometry = xcb_get_geometry_reply(dis, xcb_get_geometry(dis, current->win), NULL); /* TODO: error handling */
-    if (geometry) {
-        winx = geometry->x;     winy = geometry->y;
-        winw = geometry->width; winh = geometry->height;
-        free(geometry);
-    } else return;
-
-    pointer = xcb_query_pointer_reply(dis, xcb_query_pointer(dis, screen->root), 0);
-    if (!pointer) return;
-    mx = pointer->root_x; my = pointer->root_y;
-
-    grab_reply = xcb_grab_pointer_reply(dis, xcb_grab_pointer(dis, 0, screen->root, BUTTONMASK|XCB_EVENT_MASK_BUTTON_MOTION|XCB_EVENT_MASK_POINTER_MOTION,
-            XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE, XCB_NONE, XCB_CURRENT_TIME), NULL);
-    if (!grab_reply || grab_reply->status != XCB_GRAB_STATUS_SUCCESS) return;
-
-    if (current->isfullscrn) setfullscreen(current, False);
-    if (!current->isfloating) current->isfloating = True;
-    tile(); update_current(current);
-
-    xcb_generic_event_t *e = NULL;
-    xcb_motion_notify_event_t *ev = NULL;
-    bool ungrab = false;
-    do {
-        if (e) free(e);
-        xcb_flush(dis);
-        while(!(e = xcb_wait_for_event(dis))) xcb_flush(dis);
-        switch (e->response_type & ~0x80) {
-            case XCB_CONFIGURE_REQUEST: case XCB_MAP_REQUEST:
-                events[e->response_type & ~0x80](e);
-                break;
-            case XCB_MOTION_NOTIFY:
-                ev = (xcb_motion_notify_event_t*)e;
-                xw = (arg->i == MOVE ? winx : winw) + ev->root_x - mx;
-                yh = (arg->i == MOVE ? winy : winh) + ev->root_y - my;
-                if (arg->i == RESIZE) xcb_resize(dis, current->win, xw>MINWSZ?xw:winw, yh>MINWSZ?yh:winh);
-                else if (arg->i == MOVE) xcb_move(dis, current->win, xw, yh);
-                xcb_flush(dis);
-                break;
-            case XCB_KEY_PRESS:
-            case XCB_KEY_RELEASE:
-            case XCB_BUTTON_PRESS:
-            case XCB_BUTTON_RELEASE:
-                ungrab = true;
-        }
-    } while(!ungrab && current);
-    DEBUG("xcb: ungrab");
-    xcb_ungrab_pointer(dis, XCB_CURRENT_TIME);
+    bool known = press && (current->known & XCB_MOVE_RESIZE) == XCB_MOVE_RESIZE;
+    xcb_get_geometry_cookie_t  geometry = { 0 };
+    xcb_query_pointer_cookie_t pointer  = { 0 };
+    if (!known) {
+        geometry = xcb_get_geometry(dis, current->win);
+        pointer  = xcb_query_pointer(dis, screen->root);
+    }
+    xcb_grab_pointer_cookie_t  grab     = xcb_grab_pointer(dis, 0, screen->root, BUTTONMASK|XCB_EVENT_MASK_BUTTON_MOTION|XCB_EVENT_MASK_POINTER_MOTION,
+            XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE, XCB_NONE, XCB_CURRENT_TIME);
+    if (known) drag(arg, press->root_x, press->root_y, current->sent[0], current->sent[1], current->sent[2], current->sent[3],
+                    grab.sequence);
+    else xcb_async(current->win, (void*)(intptr_t)arg->i, dragstart, 3, geometry.sequence, pointer.sequence, grab.sequence);
 }
 
-/* each window should cover all the available screen space */
+/* the visible window should cover all the available screen space
+ * the visible window is the current one, or if that is floating, the
+ * one that was visible before. all other tiled windows are hidden,
+ * so they are unmapped instead of being drawn behind the visible one */
 void monocle(int hh, int cy) {
-    for (client *c=head; c; c=c->next) if (!ISFFT(c)) xcb_move_resize(dis, c->win, 0, cy, ww, hh);
+    client *v = (current && !ISFFT(current)) ? current:NULL;
+    for (client *c=head; c && !v; c=c->next) if (!ISFFT(c) && !c->ishidden) v = c;
+    for (client *c=head; c && !v; c=c->next) if (!ISFFT(c)) v = c;
+    for (client *c=head; c; c=c->next) if (!ISFFT(c)) c->ishidden = c != v;
+    PROBE2(layout, MONOCLE, v ? 1:0)
+    if (v) moveresize(v, 0, cy, ww, hh);
 }
 
 /* move the current client, to current->next
@@ -858,11 +1808,19 @@ void move_up() {
     tile();
 }
 
-/* cyclic focus the next window
+/* queue a new position and size for the client, applied by commit() */
+void moveresize(client *c, int x, int y, int w, int h) {
+    c->geom[0] = x; c->geom[1] = y; c->geom[2] = w; c->geom[3] = h;
+    c->dirty |= XCB_MOVE_RESIZE;
+}
+
+/* cyclic focus the next window, arg->i windows ahead if more than one
  * if the window is the last on stack, focus head */
-void next_win() {
+void next_win(const Arg *arg) {
     if (!current || !head->next) return;
-    update_current(current->next ? current->next:head);
+    client *c = current;
+    for (int n = arg->i > 1 ? arg->i:1; n--;) c = c->next ? c->next:head;
+    update_current(c);
 }
 
 /* get the previous client from the given
@@ -873,11 +1831,32 @@ client* prev_client(client *c) {
     return p;
 }
 
-/* cyclic focus the previous window
+/* cyclic focus the previous window, arg->i windows back if more than one
  * if the window is the head, focus the last stack window */
-void prev_win() {
+void prev_win(const Arg *arg) {
     if (!current || !head->next) return;
-    update_current(prev_client(prevfocus = current));
+    client *c = prevfocus = current;
+    for (int n = arg->i > 1 ? arg->i:1; n--;) c = prev_client(c);
+    update_current(c);
+}
+
+/* the priority of an event, and the window it is about if any
+ *  0 - input, keyboard mapping and focus changes
+ *  1 - windows being mapped, unmapped or destroyed
+ *  2 - configure requests, property changes and anything else */
+unsigned int priority(xcb_generic_event_t *e, xcb_window_t *w) {
+    *w = XCB_NONE;
+    switch (e->response_type & ~0x80) {
+        case XCB_KEY_PRESS: case XCB_BUTTON_PRESS: case XCB_MAPPING_NOTIFY: return 0;
+        case XCB_ENTER_NOTIFY:    *w = ((xcb_enter_notify_event_t*)e)->event;        return 0;
+        case XCB_CLIENT_MESSAGE:  *w = ((xcb_client_message_event_t*)e)->window;     return 0;
+        case XCB_MAP_REQUEST:     *w = ((xcb_map_request_event_t*)e)->window;        return 1;
+        case XCB_UNMAP_NOTIFY:    *w = ((xcb_unmap_notify_event_t*)e)->window;       return 1;
+        case XCB_DESTROY_NOTIFY:  *w = ((xcb_destroy_notify_event_t*)e)->window;     return 1;
+        case XCB_CONFIGURE_REQUEST: *w = ((xcb_configure_request_event_t*)e)->window; return 2;
+        case XCB_PROPERTY_NOTIFY: *w = ((xcb_property_notify_event_t*)e)->window;    return 2;
+        default: return 2;
+    }
 }
 
 /* property notify is called when one of the window's properties
@@ -885,16 +1864,11 @@ void prev_win() {
  */
 void propertynotify(xcb_generic_event_t *e) {
     xcb_property_notify_event_t *ev = (xcb_property_notify_event_t*)e;
-    xcb_icccm_wm_hints_t wmh;
-    client *c;
 
     DEBUG("xcb: property notify");
-    c = wintoclient(ev->window);
-    if (!c || ev->atom != XCB_ICCCM_WM_ALL_HINTS) return;
+    if (ev->atom != XCB_ICCCM_WM_ALL_HINTS || !wintoclient(ev->window)) return;
     DEBUG("xcb: got hint!");
-    if (xcb_icccm_get_wm_hints_reply(dis, xcb_icccm_get_wm_hints(dis, ev->window), &wmh, NULL)) /* TODO: error handling */
-        c->isurgent = c != current && (wmh.flags & XCB_ICCCM_WM_HINT_X_URGENCY);
-    desktopinfo();
+    xcb_async(ev->window, NULL, urgenthint, 1, xcb_icccm_get_wm_hints(dis, ev->window).sequence);
 }
 
 /* to quit just stop receiving events
@@ -905,6 +1879,143 @@ void quit(const Arg *arg) {
     running = false;
 }
 
+/* read the configuration file on top of the defaults of config.h, from
+ * CONFIG_FILE in the home directory. a line is one of the following,
+ * words are separated by blanks and a line starting with # is ignored
+ *   set master_size|border_width|panel_height|focus|unfocus value
+ *   bind mod+..+key function [argument..]
+ *   repeat mod+..+key function [argument]
+ *   button mod+..+button function [argument]
+ *   rule class desktop [follow] [float] [freeze]
+ * a binding replaces the default one for the same keys or button, the
+ * function none removes it. arguments out of range, see validarg(), and
+ * settings out of range or colors not in #rrggbb form are rejected.
+ * repeat binds a key whose auto-repeat is coalesced, the argument, or 1,
+ * is multiplied by the presses. rules are matched before the default ones.
+ * lines that cannot be read are reported and skipped, and a file that
+ * cannot be read leaves the defaults. fails only if out of memory */
+bool readconfig(config *c) {
+    static const struct { const char *name; void (*func)(const Arg *); } funcs[] = {
+        { "change_desktop", change_desktop }, { "client_to_desktop", client_to_desktop }, { "focusurgent", focusurgent },
+        { "killclient", killclient }, { "last_desktop", last_desktop }, { "mouse_aside", mouse_aside },
+        { "mousemotion", mousemotion }, { "move_down", move_down }, { "move_up", move_up }, { "next_win", next_win },
+        { "prev_win", prev_win }, { "quit", quit }, { "reload", reload }, { "resize_master", resize_master },
+        { "resize_stack", resize_stack }, { "rotate", rotate }, { "rotate_filled", rotate_filled }, { "spawn", spawn },
+        { "swap_master", swap_master }, { "switch_mode", switch_mode }, { "togglepanel", togglepanel },
+        { "togglescratch", togglescratch }, { "none", NULL },
+    };
+    char path[4096], *home = getenv("HOME"), *w[64], *p, *plus, *next;
+    unsigned int nw, na = 0, nl = 1, line = 0, f, m, v = 0;
+    long size = 0;
+    FILE *file;
+
+    *c = (config){ .focus = FOCUS, .unfocus = UNFOCUS, .mastersize = MASTER_SIZE,
+                   .borderwidth = BORDER_WIDTH, .panelheight = PANEL_HEIGHT };
+    snprintf(path, sizeof(path), "%s/%s", home ? home:".", CONFIG_FILE);
+    if ((file = fopen(path, "r"))) {
+        if (fseek(file, 0, SEEK_END) || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET)
+                || !(c->text = malloc(size + 1)) || fread(c->text, 1, size, file) != (size_t)size) {
+            fprintf(stderr, "error: cannot read %s\n", path);
+            free(c->text); c->text = NULL; size = 0;
+        } else c->text[size] = '\0';
+        fclose(file);
+    }
+    for (p = c->text; p && *p; p++) nl += *p == '\n';
+
+    /* a word takes at least two characters, with its separator, so the
+     * argument vectors and their terminators fit in size + 2 pointers */
+    if (!(c->args = malloc((size + 2) * sizeof(char*)))
+            || !(c->keys = malloc((LENGTH(keys) + nl) * sizeof(key)))
+            || !(c->buttons = malloc((LENGTH(buttons) + nl) * sizeof(Button)))
+            || !(c->rules = malloc((LENGTH(rules) + nl) * sizeof(AppRule)))) {
+        freeconfig(c);
+        return false;
+    }
+    memcpy(c->keys, keys, sizeof(keys)); c->nkeys = LENGTH(keys);
+    memcpy(c->buttons, buttons, sizeof(buttons)); c->nbuttons = LENGTH(buttons);
+
+    for (char *l = c->text; l; l = next, line++) {
+        bool ok = true;
+        if ((next = strchr(l, '\n'))) *next++ = '\0';
+        for (nw = 0, p = strtok(l, " \t\r"); p && nw < LENGTH(w); p = strtok(NULL, " \t\r")) w[nw++] = p;
+        if (!nw || w[0][0] == '#') continue;
+
+        if (!strcmp(w[0], "set") && nw == 3) {
+            double d = strtod(w[2], &p);
+            bool num = !*p, color = w[2][0] == '#' && strlen(w[2]) == 7 && strspn(w[2] + 1, "0123456789abcdefABCDEF") == 6;
+            if      (!strcmp(w[1], "master_size") && num && d > 0 && d < 1) c->mastersize = d;
+            else if (!strcmp(w[1], "border_width") && num && d >= 0 && d <= MINWSZ/2 && d == (int)d) c->borderwidth = d;
+            else if (!strcmp(w[1], "panel_height") && num && d >= 0 && d == (int)d
+                        && (!screen || d <= screen->height_in_pixels - MINWSZ)) c->panelheight = d;
+            else if (!strcmp(w[1], "focus") && color)   c->focus   = w[2];
+            else if (!strcmp(w[1], "unfocus") && color) c->unfocus = w[2];
+            else ok = false;
+        } else if ((!strcmp(w[0], "bind") || !strcmp(w[0], "repeat") || !strcmp(w[0], "button")) && nw >= 3) {
+            bool iskey = strcmp(w[0], "button"), repeat = !strcmp(w[0], "repeat");
+            unsigned int mod = 0, sym = 0;
+            for (p = w[1]; (plus = strchr(p, '+')); p = plus + 1) {
+                *plus = '\0';
+                if (!lookup('m', p, &m)) ok = false; else mod |= m;
+            }
+            if (iskey && !lookup('k', p, &sym)) {
+                if (p[0] == 'F' && isdigit((unsigned char)p[1])) sym = XK_F1 + atoi(p + 1) - 1;
+                else if (!strncmp(p, "0x", 2)) sym = strtoul(p, NULL, 16);
+                else if (p[0] && !p[1]) sym = (unsigned char)p[0];
+            } else if (!iskey && !lookup('b', p, &sym)) sym = 0;
+            for (f = 0; f < LENGTH(funcs) && strcmp(funcs[f].name, w[2]); f++);
+            if (!sym || f == LENGTH(funcs) || (funcs[f].func == spawn ? nw < 4 || repeat : nw > 4)) ok = false;
+            else if (nw == 3) v = 0;
+            else if (funcs[f].func != spawn && !lookup('a', w[3], &v)) { v = strtol(w[3], &p, 0); ok = ok && !*p; }
+            if (ok) ok = validarg(funcs[f].func, (int)v, repeat);
+            if (ok) {
+                const Arg arg = funcs[f].func == spawn ? (Arg){.com = (const char**)c->args + na} : (Arg){.i = (int)v};
+                if (funcs[f].func == spawn) { for (m = 3; m < nw; m++) c->args[na++] = w[m]; c->args[na++] = NULL; }
+                if (iskey) {
+                    for (m = 0; m < c->nkeys && !(c->keys[m].mod == mod && c->keys[m].keysym == sym); m++);
+                    memcpy(&c->keys[m], &(key){ mod, sym, funcs[f].func, arg, repeat }, sizeof(key));
+                    if (m == c->nkeys) c->nkeys++;
+                } else {
+                    for (m = 0; m < c->nbuttons && !(c->buttons[m].mask == mod && c->buttons[m].button == sym); m++);
+                    memcpy(&c->buttons[m], &(Button){ mod, sym, funcs[f].func, arg }, sizeof(Button));
+                    if (m == c->nbuttons) c->nbuttons++;
+                }
+            }
+        } else if (!strcmp(w[0], "rule") && nw >= 3 && nw <= 6) {
+            bool follow = false, floating = false, freeze = false;
+            int d = strtol(w[2], &p, 0);
+            ok = !*p && d < DESKTOPS;
+            for (m = 3; m < nw; m++)
+                if (!strcmp(w[m], "follow")) follow = true; else if (!strcmp(w[m], "float")) floating = true;
+                else if (!strcmp(w[m], "freeze")) freeze = true; else ok = false;
+            if (ok) memcpy(&c->rules[c->nrules++], &(AppRule){ w[1], d, follow, floating, freeze }, sizeof(AppRule));
+        } else ok = false;
+        if (!ok) fprintf(stderr, "error: %s:%u: cannot read line\n", path, line + 1);
+    }
+    memcpy(c->rules + c->nrules, rules, sizeof(rules)); c->nrules += LENGTH(rules);
+    return true;
+}
+
+/* set the border color of every client, focused or not */
+void recolor(void) {
+    save_desktop(current_desktop);
+    for (int d=0; d<DESKTOPS; d++) for (client *c=desktops[d].head; c; c=c->next)
+        xcb_change_window_attributes(dis, c->win, XCB_CW_BORDER_PIXEL, c == desktops[d].current ? &win_focus:&win_unfocus);
+    if (scratch) xcb_change_window_attributes(dis, scratch, XCB_CW_BORDER_PIXEL, &win_focus);
+}
+
+/* append the event to the trace file given with -r */
+void record(xcb_generic_event_t *e) {
+    tracerecord rec = { .usec = (msnow() - tstart) * 1e3 };
+    memcpy(rec.event, e, sizeof(rec.event));
+    if (fwrite(&rec, sizeof(rec), 1, trace) != 1) { warn("cannot write trace"); fclose(trace); trace = NULL; }
+}
+
+/* ask for the configuration file to be read again, as SIGHUP does,
+ * once the event that asked for it has been handled */
+void reload() {
+    kill(getpid(), SIGHUP);
+}
+
 /* remove the specified client
  *
  * note, the removing client can be on any desktop,
@@ -917,19 +2028,75 @@ void removeclient(client *c) {
     for (bool found = false; nd<DESKTOPS && !found; nd++)
         for (select_desktop(nd), p = &head; *p && !(found = *p == c); p = &(*p)->next);
     *p = c->next;
+    clientlist(c->win, false);
     if (c == prevfocus) prevfocus = prev_client(current);
     if (c == current || !head->next) update_current(prevfocus);
-    free(c); c = NULL;
+    if (c->alarm) xcb_sync_destroy_alarm(dis, c->alarm);
+    free(c); c = NULL; nclients--;
     if (cd == nd -1) tile(); else select_desktop(cd);
 }
 
-/* resize the master window - check for boundary size limits
+/* whether a key press runs a binding whose auto-repeat is coalesced */
+bool repeatable(xcb_key_press_event_t *ev) {
+    xcb_keysym_t keysym = xcb_get_keysym(ev->detail);
+    for (unsigned int i=0; i<cfg.nkeys; i++)
+        if (keysym == cfg.keys[i].keysym && CLEANMASK(cfg.keys[i].mod) == CLEANMASK(ev->state) && cfg.keys[i].func)
+            return cfg.keys[i].repeat;
+    return false;
+}
+
+/* feed the events of a trace recorded with -r through the same handlers
+ * one by one, and report on standard error stream, for every event and
+ * summed up per event type, the time spent in the handler including the
+ * layout commit, and the number of requests it sent to the server.
+ * requests are counted by their sequence numbers, between two no-ops.
+ * replies and real events are drained in between, but not accounted */
+void replay(const char *path) {
+    unsigned int count[XCB_NO_OPERATION] = {0}, requests[XCB_NO_OPERATION] = {0}, n = 0;
+    double spent[XCB_NO_OPERATION] = {0}, worst[XCB_NO_OPERATION] = {0};
+    char magic[sizeof(TRACEMAGIC) - 1];
+    tracerecord rec;
+    FILE *f;
+
+    if (!(f = fopen(path, "rb"))) err(EXIT_FAILURE, "cannot open trace %s", path);
+    if (fread(magic, sizeof(magic), 1, f) != 1 || memcmp(magic, TRACEMAGIC, sizeof(magic)))
+        errx(EXIT_FAILURE, "error: %s is not a monsterwm trace\n", path);
+
+    fprintf(stderr, "# event type usec handler-us requests\n");
+    for (xcb_generic_event_t ev, *e; fread(&rec, sizeof(rec), 1, f) == 1; n++) {
+        memset(&ev, 0, sizeof(ev));
+        memcpy(&ev, rec.event, sizeof(rec.event));
+        unsigned int type = ev.response_type & ~0x80, seq = xcb_no_operation(dis).sequence;
+        double t = msnow();
+        if (type < XCB_NO_OPERATION && events[type]) events[type](&ev);
+        commit();
+        t = msnow() - t;
+        unsigned int sent = xcb_no_operation(dis).sequence - seq - 1;
+        fprintf(stderr, "%u %u %llu %.1f %u\n", n, type, (unsigned long long)rec.usec, t * 1e3, sent);
+        if (type < XCB_NO_OPERATION) {
+            count[type]++; spent[type] += t; requests[type] += sent;
+            if (t > worst[type]) worst[type] = t;
+        }
+        xcb_flush(dis);
+        while ((e = xcb_poll_for_event(dis))) free(e);
+        xcb_collect();
+    }
+    fclose(f);
+
+    fprintf(stderr, "# type count total-ms avg-us max-us requests\n");
+    for (unsigned int i=0; i<XCB_NO_OPERATION; i++) if (count[i])
+        fprintf(stderr, "%u %u %.3f %.1f %.1f %u\n", i, count[i], spent[i], spent[i] * 1e3 / count[i], worst[i] * 1e3, requests[i]);
+}
+
+/* resize the master window - the size is kept within the boundary limits
  * the size of a window can't be less than MINWSZ
  */
 void resize_master(const Arg *arg) {
-    int msz = (mode == BSTACK ? wh:ww) * MASTER_SIZE + master_size + arg->i;
-    if (msz < MINWSZ || (mode == BSTACK ? wh:ww) - msz < MINWSZ) return;
-    master_size += arg->i;
+    int d = mode == BSTACK ? wh:ww, size = d * cfg.mastersize + master_size, msz = size + arg->i;
+    if (msz > d - MINWSZ) msz = d - MINWSZ;
+    if (msz < MINWSZ) msz = MINWSZ;
+    if (msz == size || (arg->i > 0) != (msz > size)) return;
+    master_size += msz - size;
     tile();
 }
 
@@ -951,17 +2118,44 @@ void rotate_filled(const Arg *arg) {
     change_desktop(&(Arg){.i = (DESKTOPS + current_desktop + n) % DESKTOPS});
 }
 
-/* main event loop - on receival of an event call the appropriate event handler */
+/* main event loop - on receival of events call the appropriate event handlers
+ * the events queued are handled together, input first, see dispatch().
+ * replies to async requests are collected in between batches, only when
+ * there is nothing queued wait for the connection or a signal.
+ * the layout changes made by a batch are committed before flushing.
+ * the watchdog's heartbeat runs while the wm is busy, see watchdog().
+ * with -r every handled event is recorded to the trace file */
 void run(void) {
-    xcb_generic_event_t *ev;
+    xcb_generic_event_t *ev, *batch[EVBATCH];
+    unsigned int n;
+    struct pollfd fds[] = { { .fd = xcb_get_file_descriptor(dis), .events = POLLIN }, { .fd = sigfd, .events = POLLIN },
+                            { .fd = -1, .events = POLLOUT } };
     while(running) {
+        watcharm(true);
+        commit();
+        /* close the range with a request of its own, so that events the user
+         * causes next carry a later sequence number than the tracked ones */
+        if (rangeopen) xcb_no_operation(dis);
         xcb_flush(dis);
+        rangeopen = false;
         if (xcb_connection_has_error(dis)) err(EXIT_FAILURE, "error: X11 connection got interrupted\n");
-        if ((ev = xcb_wait_for_event(dis))) {
-            if (events[ev->response_type & ~0x80]) events[ev->response_type & ~0x80](ev);
-            else { DEBUGP("xcb: unimplented event: %d\n", ev->response_type & ~0x80); }
-            free(ev);
+        if (!(ev = xcb_poll_for_event(dis)) && !xcb_collect() && !(ev = xcb_poll_for_queued_event(dis))) {
+            if (trace) fflush(trace);
+            fds[2].fd = statusoff < statuslen[0] || statuslen[1] ? STDOUT_FILENO : -1; /* a status snapshot waits */
+            watcharm(false);
+            if (poll(fds, LENGTH(fds), syncheld ? SYNC_TIMEOUT : -1) <= 0) continue;
+            if (fds[1].revents & POLLIN) signals();
+            if (fds[2].revents) flushinfo();
+            continue;
+        }
+        if (!ev) continue;
+        /* drain what is queued, so input is not handled behind client traffic */
+        for (n = 0; ev; ev = n < LENGTH(batch) ? xcb_poll_for_queued_event(dis) : NULL) {
+            if (xcb_ignored(ev)) { nsuppressed++; free(ev); continue; }
+            if (trace) record(ev);
+            batch[n++] = ev;
         }
+        dispatch(batch, n);
     }
 }
 
@@ -991,118 +2185,251 @@ void select_desktop(int i) {
     current_desktop = i;
 }
 
-/* set or unset fullscreen state of client */
+/* store the allocated color pixel, and recolor the borders if it changed */
+void setcolor(cookie *r) {
+    xcb_alloc_color_reply_t *c = r->reply[0];
+    if (!c) errx(EXIT_FAILURE, "error: cannot allocate color\n");
+    if (*(unsigned int*)r->data == c->pixel) return;
+    *(unsigned int*)r->data = c->pixel;
+    recolor();
+}
+
+/* queue a new border width for the client, applied by commit() */
+void setborder(client *c, int w) {
+    c->geom[4] = w;
+    c->dirty |= XCB_BORDER;
+}
+
+/* set or unset fullscreen state of client, and ask compositors
+ * to unredirect the window while it covers the screen */
 void setfullscreen(client *c, bool fullscrn) {
     DEBUGP("xcb: set fullscreen: %d\n", fullscrn);
-    long data[] = { fullscrn ? netatoms[NET_FULLSCREEN] : XCB_NONE };
-    if (fullscrn != c->isfullscrn) xcb_change_property(dis, XCB_PROP_MODE_REPLACE, c->win, netatoms[NET_WM_STATE], XCB_ATOM_ATOM, 32, fullscrn, data);
-    if ((c->isfullscrn = fullscrn)) xcb_move_resize(dis, c->win, 0, 0, ww, wh + PANEL_HEIGHT);
-    xcb_border_width(dis, c->win, (!head->next || c->isfullscrn
-                || (mode == MONOCLE && !ISFFT(c))) ? 0:BORDER_WIDTH);
+    if (c->isfullscrn != fullscrn && fullscrn)
+        xcb_change_property(dis, XCB_PROP_MODE_REPLACE, c->win, netatoms[NET_BYPASS_COMPOSITOR], XCB_ATOM_CARDINAL, 32, 1, &(uint32_t){1});
+    else if (c->isfullscrn != fullscrn) xcb_delete_property(dis, c->win, netatoms[NET_BYPASS_COMPOSITOR]);
+    if ((c->isfullscrn = fullscrn)) moveresize(c, 0, 0, ww, wh + cfg.panelheight);
     update_current(c);
 }
 
-/* get numlock modifier using xcb */
-int setup_keyboard(void)
-{
-    xcb_get_modifier_mapping_reply_t *reply;
-    xcb_keycode_t                    *modmap;
-    xcb_keycode_t                    *numlock;
+/* map or unmap a window the layout shows or hides
+ * and let the client know it is iconified */
+void seticonic(client *c, bool iconic) {
+    if ((c->isiconic = iconic)) xcb_unmap(dis, c->win); else xcb_map(dis, c->win);
+    setclientstate(c, iconic, c == desktops[visible_desktop].current);
+}
 
-    reply   = xcb_get_modifier_mapping_reply(dis, xcb_get_modifier_mapping_unchecked(dis), NULL); /* TODO: error checking */
-    if (!reply) return -1;
+/* find the numlock modifier in the modifier mapping
+ * and grab the keys and buttons for every lock combination */
+void setnumlock(cookie *r) {
+    xcb_get_modifier_mapping_reply_t *reply = r->reply[0];
+    xcb_keycode_t                    *modmap, *numlock;
 
-    modmap = xcb_get_modifier_mapping_keycodes(reply);
-    if (!modmap) return -1;
+    if (!reply || !(modmap = xcb_get_modifier_mapping_keycodes(reply)))
+        err(EXIT_FAILURE, "error: failed to setup keyboard\n");
 
     numlock = xcb_get_keycodes(XK_Num_Lock);
     for (unsigned int i=0; i<8; i++)
        for (unsigned int j=0; j<reply->keycodes_per_modifier; j++) {
            xcb_keycode_t keycode = modmap[i * reply->keycodes_per_modifier + j];
            if (keycode == XCB_NO_SYMBOL) continue;
-           for (unsigned int n=0; numlock[n] != XCB_NO_SYMBOL; n++)
+           for (unsigned int n=0; numlock && numlock[n] != XCB_NO_SYMBOL; n++)
                if (numlock[n] == keycode) {
                    DEBUGP("xcb: found num-lock %d\n", 1 << i);
                    numlockmask = 1 << i;
                    break;
                }
        }
-
-    return 0;
+    free(numlock);
+    grabkeys();
+    grabbuttons();
+    startup_phase("keyboard");
+}
+
+/* publish the ICCCM WM_STATE and EWMH _NET_WM_STATE of the client
+ * a client is hidden when it is iconic or on a hidden desktop,
+ * and focused when it is the current client of the visible desktop.
+ * the atoms the client set itself are kept, see keepstate().
+ * the properties are only written when the state changed */
+void setclientstate(client *c, bool hidden, bool focused) {
+    int state = (hidden ? STATE_HIDDEN:0) | (focused ? STATE_FOCUSED:0) | (c->isfullscrn ? STATE_FULLSCREEN:0);
+    if (state == c->state) return;
+    if (c->state == -1 || (state ^ c->state) & STATE_HIDDEN) {
+        unsigned int wmstate[] = { hidden ? XCB_ICCCM_WM_STATE_ICONIC:XCB_ICCCM_WM_STATE_NORMAL, XCB_NONE };
+        xcb_change_property(dis, XCB_PROP_MODE_REPLACE, c->win, wmatoms[WM_STATE], wmatoms[WM_STATE], 32, 2, wmstate);
+    }
+    xcb_atom_t atoms[MAXSTATES + 3]; unsigned int n = 0;
+    for (unsigned int i=0; i<c->nstates; i++) atoms[n++] = c->states[i];
+    if (state & STATE_FULLSCREEN) atoms[n++] = netatoms[NET_FULLSCREEN];
+    if (state & STATE_HIDDEN)     atoms[n++] = netatoms[NET_HIDDEN];
+    if (state & STATE_FOCUSED)    atoms[n++] = netatoms[NET_FOCUSED];
+    xcb_change_property(dis, XCB_PROP_MODE_REPLACE, c->win, netatoms[NET_WM_STATE], XCB_ATOM_ATOM, 32, n, atoms);
+    c->state = state;
 }
 
 /* set initial values
  * root window - screen height/width - atoms - xerror handler
  * set masks for reporting events handled by the wm
  * and propagate the suported net atoms
+ *
+ * all independent requests are sent at once and their replies
+ * collected together, the keyboard setup completes asynchronously
  */
 int setup(int default_screen) {
-    sigchld();
+    xcb_intern_atom_cookie_t wmcookies[WM_COUNT], netcookies[NET_COUNT];
+    xcb_void_cookie_t otherwm;
+    sigset_t mask;
+
+    /* children are reaped and stats dumped from the main loop */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGHUP);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1 || (sigfd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC)) == -1)
+        err(EXIT_FAILURE, "cannot set up signal handling");
+    if (STALL_THRESHOLD) sigaction(SIGALRM, &(struct sigaction){ .sa_handler = watchdog, .sa_flags = SA_RESTART }, NULL);
+
     screen = xcb_screen_of_display(dis, default_screen);
     if (!screen) err(EXIT_FAILURE, "error: cannot aquire screen\n");
 
+    if (!readconfig(&cfg)) err(EXIT_FAILURE, "cannot read configuration");
     ww = screen->width_in_pixels;
-    wh = screen->height_in_pixels - PANEL_HEIGHT;
+    wh = screen->height_in_pixels - cfg.panelheight;
     for (unsigned int i=0; i<DESKTOPS; i++) save_desktop(i);
 
-    win_focus   = getcolor(FOCUS);
-    win_unfocus = getcolor(UNFOCUS);
-
-    /* setup keyboard */
-    if (setup_keyboard() == -1)
+    /* check if another wm is running, set up atoms for dialog/notification
+     * windows, get the keyboard mapping and the numlock modifier */
+    otherwm = xcb_select_root();
+    xcb_prefetch_extension_data(dis, &xcb_sync_id);
+    xcb_intern_atoms(WM_ATOM_NAME, wmcookies, WM_COUNT);
+    xcb_intern_atoms(NET_ATOM_NAME, netcookies, NET_COUNT);
+    if (!(keysyms = xcb_key_symbols_alloc(dis)))
         err(EXIT_FAILURE, "error: failed to setup keyboard\n");
+    xcb_async(XCB_NONE, NULL, setnumlock, 1, xcb_get_modifier_mapping(dis).sequence);
+    getcolor(cfg.focus, &win_focus);
+    getcolor(cfg.unfocus, &win_unfocus);
+    xcb_flush(dis);
+    startup_phase("requests");
 
-    /* set up atoms for dialog/notification windows */
-    xcb_get_atoms(WM_ATOM_NAME, wmatoms, WM_COUNT);
-    xcb_get_atoms(NET_ATOM_NAME, netatoms, NET_COUNT);
-
-    /* check if another wm is running */
-    if (xcb_checkotherwm())
+    if (xcb_checkotherwm(otherwm))
         err(EXIT_FAILURE, "error: other wm is running\n");
+    xcb_get_atoms(WM_ATOM_NAME, wmcookies, wmatoms, WM_COUNT);
+    xcb_get_atoms(NET_ATOM_NAME, netcookies, netatoms, NET_COUNT);
+    const xcb_query_extension_reply_t *syncext = xcb_get_extension_data(dis, &xcb_sync_id);
+    if ((hassync = syncext && syncext->present && syncext->first_event + XCB_SYNC_ALARM_NOTIFY < XCB_NO_OPERATION))
+        xcb_discard_reply(dis, xcb_sync_initialize(dis, 3, 1).sequence);
+    startup_phase("replies");
 
     xcb_change_property(dis, XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_SUPPORTED], XCB_ATOM_ATOM, 32, NET_COUNT, netatoms);
-    grabkeys();
 
     /* set events */
     for (unsigned int i=0; i<XCB_NO_OPERATION; i++) events[i] = NULL;
+    events[0]                       = xerror;
     events[XCB_BUTTON_PRESS]        = buttonpress;
     events[XCB_CLIENT_MESSAGE]      = clientmessage;
     events[XCB_CONFIGURE_REQUEST]   = configurerequest;
     events[XCB_DESTROY_NOTIFY]      = destroynotify;
     events[XCB_ENTER_NOTIFY]        = enternotify;
     events[XCB_KEY_PRESS]           = keypress;
+    events[XCB_MAPPING_NOTIFY]      = mappingnotify;
     events[XCB_MAP_REQUEST]         = maprequest;
     events[XCB_PROPERTY_NOTIFY]     = propertynotify;
     events[XCB_UNMAP_NOTIFY]        = unmapnotify;
+    if (hassync) events[syncext->first_event + XCB_SYNC_ALARM_NOTIFY] = syncnotify;
+
+    unsigned int desktops_count = DESKTOPS;
+    xcb_change_property(dis, XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_NUMBER_OF_DESKTOPS], XCB_ATOM_CARDINAL, 32, 1, &desktops_count);
+    xcb_change_property(dis, XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_CURRENT_DESKTOP], XCB_ATOM_CARDINAL, 32, 1, &current_desktop);
+    xcb_delete_property(dis, screen->root, netatoms[NET_CLIENT_LIST]);
+    xcb_delete_property(dis, screen->root, netatoms[NET_CLIENT_STACKING]);
 
     change_desktop(&(Arg){.i = DEFAULT_DESKTOP});
+
+    /* a cgroup per desktop, with a frozen subgroup for the freeze rules */
+    uname(&host);
+    cgwrite(-1, false, "cgroup.subtree_control", "+cpu");
+    for (int d=0; CGROUP_DIR[0] && d<DESKTOPS; d++) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/desktop%d", CGROUP_DIR, d);
+        mkdir(path, 0755);
+        snprintf(path, sizeof(path), "%s/desktop%d/frozen", CGROUP_DIR, d);
+        mkdir(path, 0755);
+        cgwrite(d, false, "cpu.weight", "%d", d == current_desktop ? CPU_WEIGHT:CPU_WEIGHT_BG);
+        cgwrite(d, true, "cgroup.freeze", d == current_desktop ? "0":"1");
+    }
+    scratchpid = launch(scratchcmd);
+    scratchstart = msnow();
+    startup_phase("setup");
     return 0;
 }
 
-void sigchld() {
-    if (signal(SIGCHLD, sigchld) == SIG_ERR)
-        err(EXIT_FAILURE, "cannot install SIGCHLD handler");
-    while(0 < waitpid(-1, NULL, WNOHANG));
+/* append s, then v in base unless base is 0, to buf of size holding n
+ * characters, and return the new length. stdio is not safe to call
+ * from a signal handler */
+size_t sigappend(char *buf, size_t n, size_t size, const char *s, unsigned long v, unsigned int base) {
+    char digits[24];
+    unsigned int k = 0;
+    while (*s && n < size) buf[n++] = *s++;
+    if (base) do digits[k++] = "0123456789abcdef"[v % base]; while ((v /= base));
+    while (k && n < size) buf[n++] = digits[--k];
+    return n;
+}
+
+/* handle the signals queued on the signal fd
+ * reap children on SIGCHLD, print the stats on SIGUSR1 and
+ * read the configuration file again on SIGHUP
+ * the scratchpad command is started again when it exits, unless
+ * it did not last a second, which means it cannot run */
+void signals(void) {
+    struct signalfd_siginfo si;
+    pid_t pid;
+    while (read(sigfd, &si, sizeof(si)) == sizeof(si))
+        if (si.ssi_signo == SIGUSR1) dumpstats();
+        else if (si.ssi_signo == SIGHUP) loadconfig();
+    while(0 < (pid = waitpid(-1, NULL, WNOHANG))) if (pid == scratchpid && running) {
+        if (msnow() - scratchstart < 1000) fprintf(stderr, "error: scratchpad %s exited, not respawning\n", scratchcmd[0]);
+        scratchpid = msnow() - scratchstart < 1000 ? 0 : launch(scratchcmd);
+        scratchstart = msnow();
+    }
 }
 
-/* execute a command */
+/* execute a command, in the cgroup of the current desktop */
 void spawn(const Arg *arg) {
-    if (fork()) return;
-    if (dis) close(screen->root);
-    setsid();
-    execvp((char*)arg->com[0], (char**)arg->com);
-    fprintf(stderr, "error: execvp %s", (char *)arg->com[0]);
-    perror(" failed"); /* also prints the err msg */
-    exit(EXIT_SUCCESS);
+    pid_t pid = launch(arg->com);
+    if (pid) cgwrite(current_desktop, false, "cgroup.procs", "%d", pid);
+}
+
+/* with -T print the time spent in a startup phase, and since start */
+void startup_phase(const char *name) {
+    double now;
+    if (!timings) return;
+    now = msnow();
+    fprintf(stderr, "monsterwm: %-9s %8.3f ms  (total %8.3f ms)\n", name, now - tphase, now - tstart);
+    tphase = now;
+}
+
+/* publish _NET_CLIENT_LIST_STACKING, bottom to top, given the windows
+ * of the visible desktop from top to bottom. the windows of the hidden
+ * desktops are unmapped, they are kept at the bottom */
+void stackinfo(xcb_window_t *w, unsigned int n) {
+    xcb_window_t sl[stacking.n + n];
+    unsigned int m = 0;
+    for (unsigned int i=0; i<stacking.n; i++) {
+        bool found = false;
+        for (unsigned int k=0; k<n && !found; k++) found = stacking.win[i] == w[k];
+        if (!found) sl[m++] = stacking.win[i];
+    }
+    while (n) sl[m++] = w[--n];
+    xcb_publish_windows(&stacking, netatoms[NET_CLIENT_STACKING], sl, m);
 }
 
 /* arrange windows in normal or bottom stack tile */
 void stack(int hh, int cy) {
     client *c = NULL, *t = NULL; bool b = mode == BSTACK;
-    int n = 0, d = 0, z = b ? ww:hh, ma = (mode == BSTACK ? wh:ww) * MASTER_SIZE + master_size;
+    int n = 0, d = 0, z = b ? ww:hh, ma = (mode == BSTACK ? wh:ww) * cfg.mastersize + master_size;
 
     /* count stack windows and grab first non-floating, non-fullscreen window */
     for (t = head; t; t=t->next) if (!ISFFT(t)) { if (c) ++n; else c = t; }
+    PROBE2(layout, mode, c ? n + 1:0)
 
     /* if there is only one window, it should cover the available screen space
      * if there is only one stack window (n == 1) then we don't care about growth
@@ -1129,28 +2456,54 @@ void stack(int hh, int cy) {
      *     the first stack window so that it satisfies growth, and doesn't create gaps
      *     on the bottom of the screen.  */
     if (!c) return; else if (!n) {
-        xcb_move_resize(dis, c->win, 0, cy, ww - 2*BORDER_WIDTH, hh - 2*BORDER_WIDTH);
+        moveresize(c, 0, cy, ww - 2*cfg.borderwidth, hh - 2*cfg.borderwidth);
         return;
     } else if (n > 1) { d = (z - growth)%n + growth; z = (z - growth)/n; }
 
     /* tile the first non-floating, non-fullscreen window to cover the master area */
-    if (b) xcb_move_resize(dis, c->win, 0, cy, ww - 2*BORDER_WIDTH, ma - BORDER_WIDTH);
-    else   xcb_move_resize(dis, c->win, 0, cy, ma - BORDER_WIDTH, hh - 2*BORDER_WIDTH);
+    if (b) moveresize(c, 0, cy, ww - 2*cfg.borderwidth, ma - cfg.borderwidth);
+    else   moveresize(c, 0, cy, ma - cfg.borderwidth, hh - 2*cfg.borderwidth);
 
     /* tile the next non-floating, non-fullscreen (first) stack window with growth|d */
     for (c=c->next; c && ISFFT(c); c=c->next);
-    int cx = b ? 0:ma, cw = (b ? hh:ww) - 2*BORDER_WIDTH - ma, ch = z - BORDER_WIDTH;
-    if (b) xcb_move_resize(dis, c->win, cx, cy += ma, ch - BORDER_WIDTH + d, cw);
-    else   xcb_move_resize(dis, c->win, cx, cy, cw, ch - BORDER_WIDTH + d);
+    int cx = b ? 0:ma, cw = (b ? hh:ww) - 2*cfg.borderwidth - ma, ch = z - cfg.borderwidth;
+    if (b) moveresize(c, cx, cy += ma, ch - cfg.borderwidth + d, cw);
+    else   moveresize(c, cx, cy, cw, ch - cfg.borderwidth + d);
 
     /* tile the rest of the non-floating, non-fullscreen stack windows */
     for (b?(cx+=ch+d):(cy+=ch+d), c=c->next; c; c=c->next) {
         if (ISFFT(c)) continue;
-        if (b) { xcb_move_resize(dis, c->win, cx, cy, ch, cw); cx += z; }
-        else   { xcb_move_resize(dis, c->win, cx, cy, cw, ch); cy += z; }
+        if (b) { moveresize(c, cx, cy, ch, cw); cx += z; }
+        else   { moveresize(c, cx, cy, cw, ch); cy += z; }
     }
 }
 
+/* the sync counter of a client reached the value it was asked for,
+ * the client drew the last size so the held geometry can be sent */
+void syncnotify(xcb_generic_event_t *e) {
+    xcb_sync_alarm_notify_event_t *ev = (xcb_sync_alarm_notify_event_t*)e;
+    save_desktop(current_desktop);
+    for (int d=0; d<DESKTOPS; d++) for (client *c=desktops[d].head; c; c=c->next)
+        if (c->alarm == ev->alarm) c->syncing = false;
+}
+
+/* ask a client to report when it has drawn the next size, through
+ * a _NET_WM_SYNC_REQUEST message and the alarm on its counter.
+ * returns false if the client is still drawing the previous size,
+ * unless it did not answer within SYNC_TIMEOUT milliseconds */
+bool syncrequest(client *c) {
+    if (c->syncing && msnow() - c->synctime < SYNC_TIMEOUT) return false;
+    c->syncvalue++;
+    unsigned int values[] = { c->syncvalue >> 32, c->syncvalue & 0xffffffff };
+    xcb_client_message_event_t ev = { .response_type = XCB_CLIENT_MESSAGE, .format = 32, .window = c->win, .type = wmatoms[WM_PROTOCOLS],
+        .data.data32 = { netatoms[NET_SYNC], XCB_CURRENT_TIME, values[1], values[0], 0 } };
+    xcb_sync_change_alarm(dis, c->alarm, XCB_SYNC_CA_VALUE, values);
+    xcb_send_event(dis, 0, c->win, XCB_EVENT_MASK_NO_EVENT, (char*)&ev);
+    c->syncing = true;
+    c->synctime = msnow();
+    return true;
+}
+
 /* swap master window with current or
  * if current is head swap with next
  * if current is not head, then head
@@ -1171,11 +2524,31 @@ void switch_mode(const Arg *arg) {
     desktopinfo();
 }
 
-/* tile all windows of current desktop - call the handler tiling function */
+/* tile all windows of current desktop - call the handler tiling function
+ *
+ * a window should have borders in any case, except if
+ *  - the window is the only window on screen
+ *  - the window is fullscreen
+ *  - the mode is MONOCLE and the window is not floating or transient
+ *
+ * windows are shown unless the layout hides them, see monocle()
+ * the geometry is only queued, commit() applies it */
 void tile(void) {
     if (!head) return; /* nothing to arange */
-    layout[head->next ? mode : MONOCLE](wh + (showpanel ? 0:PANEL_HEIGHT),
-                                (TOP_PANEL && showpanel ? PANEL_HEIGHT:0));
+    if (current && current->isfullscrn) { /* hide the tiled windows it covers, and skip laying them out */
+        for (client *c=head; c; c=c->next) if (!ISFFT(c)) c->ishidden = true;
+        setborder(current, 0);
+        return;
+    }
+    for (client *c=head; c; c=c->next) c->ishidden = false;
+    for (client *c=head; c; c=c->next)
+        setborder(c, (!head->next || c->isfullscrn || (mode == MONOCLE && !ISFFT(c))) ? 0:cfg.borderwidth);
+    double t = msnow();
+    PROBE(tile__start)
+    layout[head->next ? mode : MONOCLE](wh + (showpanel ? 0:cfg.panelheight),
+                                (TOP_PANEL && showpanel ? cfg.panelheight:0));
+    PROBE(tile__done)
+    flight(FL_LAYOUT, head->next ? mode : MONOCLE, 0, (msnow() - t) * 1000);
 }
 
 /* toggle visibility state of the panel */
@@ -1184,12 +2557,31 @@ void togglepanel() {
     tile();
 }
 
+/* show or hide the scratchpad above the windows of the current desktop,
+ * it is not a client so the layout is left alone */
+void togglescratch() {
+    if (!scratch) return;
+    if ((scratchshown = !scratchshown)) {
+        xcb_raise_window(dis, scratch);
+        xcb_map(dis, scratch);
+        xcb_set_input_focus(dis, XCB_INPUT_FOCUS_POINTER_ROOT, scratch, XCB_CURRENT_TIME);
+    } else {
+        xcb_unmap(dis, scratch);
+        if (current) xcb_set_input_focus(dis, XCB_INPUT_FOCUS_POINTER_ROOT, current->win, XCB_CURRENT_TIME);
+    }
+}
+
 /* windows that request to unmap should lose their
  * client, so no invisible windows exist on screen
+ *
+ * a window without a client can only be waiting for its manage()
+ * replies, an unmap of it, such as the synthetic one of an ICCCM
+ * withdrawal, means it must not be managed once they arrive
  */
 void unmapnotify(xcb_generic_event_t *e) {
     xcb_unmap_notify_event_t *ev = (xcb_unmap_notify_event_t *)e;
     client *c = wintoclient(ev->window);
+    if (!c) xcb_cancel(ev->window);
     if (c && ev->event != screen->root) removeclient(c);
     desktopinfo();
 }
@@ -1205,10 +2597,8 @@ void unmapnotify(xcb_generic_event_t *e) {
  *  - fullscreen windows
  *  - tiled windows
  *
- * a window should have borders in any case, except if
- *  - the window is the only window on screen
- *  - the window is fullscreen
- *  - the mode is MONOCLE and the window is not floating or transient */
+ * borders are set by tile(), the hidden and focused
+ * states of the desktop's clients are published here */
 void update_current(client *c) {
     if (!head) {
         xcb_delete_property(dis, screen->root, netatoms[NET_ACTIVE]);
@@ -1216,28 +2606,123 @@ void update_current(client *c) {
         return;
     } else if (c == prevfocus) { prevfocus = prev_client(current = prevfocus ? prevfocus:head);
     } else if (c != current) { prevfocus = current; current = c; }
+    PROBE1(focus__start, current->win)
+    double t = msnow();
 
     /* num of n:all fl:fullscreen ft:floating/transient windows */
     int n = 0, fl = 0, ft = 0;
+    bool shown = current_desktop == visible_desktop;
     for (c = head; c; c = c->next, ++n) if (ISFFT(c)) { fl++; if (!c->isfullscrn) ft++; }
     xcb_window_t w[n];
+    unsigned int all = n;
     w[(current->isfloating||current->istransient)?0:ft] = current->win;
     for (fl += !ISFFT(current)?1:0, c = head; c; c = c->next) {
-        xcb_change_window_attributes(dis, c->win, XCB_CW_BORDER_PIXEL, (c == current ? &win_focus:&win_unfocus));
-        xcb_border_width(dis, c->win, (!head->next || c->isfullscrn
-                    || (mode == MONOCLE && !ISFFT(c))) ? 0:BORDER_WIDTH);
-        //if (CLICK_TO_FOCUS) xcb_grab_button(dis, 1, c->win, XCB_EVENT_MASK_BUTTON_PRESS, XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC,
-        //   screen->root, XCB_NONE, XCB_BUTTON_INDEX_1, XCB_BUTTON_MASK_ANY);
+        if (c == current || !(current->isfullscrn && c->ishidden)) /* covered windows keep their border */
+            xcb_change_window_attributes(dis, c->win, XCB_CW_BORDER_PIXEL, (c == current ? &win_focus:&win_unfocus));
+        setclientstate(c, !shown || c->isiconic, shown && c == current);
         if (c != current) w[c->isfullscrn ? --fl : ISFFT(c) ? --ft : --n] = c->win;
     }
 
-    /* restack */
-    for (ft = 0; ft <= n; ++ft) xcb_raise_window(dis, w[n-ft]);
+    /* restack, the tiled windows below w[n] do not overlap and stay in place */
+    for (ft = n; ft--;) xcb_raise_window(dis, w[ft]);
+    if (shown) stackinfo(w, all);
 
     xcb_change_property(dis, XCB_PROP_MODE_REPLACE, screen->root, netatoms[NET_ACTIVE], XCB_ATOM_WINDOW, 32, 1, &current->win);
     xcb_set_input_focus(dis, XCB_INPUT_FOCUS_POINTER_ROOT, current->win, XCB_CURRENT_TIME);
-    //if (CLICK_TO_FOCUS) xcb_ungrab_button(dis, XCB_BUTTON_INDEX_1, XCB_NONE, current->win);
     tile();
+    PROBE1(focus__done, current->win)
+    flight(FL_FOCUS, 0, current->win, (msnow() - t) * 1000);
+}
+
+/* set the urgent state of a client from its hints */
+void urgenthint(cookie *r) {
+    xcb_icccm_wm_hints_t wmh;
+    client *c = wintoclient(r->win);
+    if (!c || !r->reply[0] || !xcb_icccm_get_wm_hints_from_reply(&wmh, r->reply[0])) return;
+    c->isurgent = c != current && (wmh.flags & XCB_ICCCM_WM_HINT_X_URGENCY);
+    desktopinfo();
+}
+
+/* whether i is a valid argument of func from the configuration file, so
+ * it is never used as an index out of range. only the functions that
+ * take a number of steps or a delta can repeat, see keypress() */
+bool validarg(void (*func)(const Arg *), int i, bool repeat) {
+    if (repeat && func != next_win && func != prev_win && func != resize_master && func != resize_stack) return false;
+    if (func == switch_mode) return i >= 0 && i < MODES;
+    if (func == change_desktop || func == client_to_desktop) return i >= 0 && i < DESKTOPS;
+    if (func == rotate || func == rotate_filled) return i > -DESKTOPS && i < DESKTOPS && i;
+    if (func == mousemotion) return i >= 0 && i <= (MOVE|OUTLINE);
+    return true;
+}
+
+/* start or stop the watchdog's heartbeat, a SIGALRM every half of
+ * STALL_THRESHOLD. it is stopped while the wm sleeps in run() */
+void watcharm(bool on) {
+    long us = on ? STALL_THRESHOLD * 500L : 0;
+    struct itimerval t = { { us / 1000000, us % 1000000 }, { us / 1000000, us % 1000000 } };
+    if (!STALL_THRESHOLD || on == watcharmed) return;
+    setitimer(ITIMER_REAL, &t, NULL);
+    watcharmed = on;
+}
+
+/* mark the start of the handler of an event type, or REPLY, for win */
+void watchbegin(unsigned int type, xcb_window_t win) {
+    watchtype = type;
+    watchwin = win;
+    watchstart = msnow();
+    watchgen++;
+    watching = 1;
+}
+
+/* on SIGALRM, report the handler being run once it has been running for
+ * longer than STALL_THRESHOLD ms, with the last request the flight
+ * recorder saw sent or waited for. it is accounted once it returns, see
+ * watchend(). only async-signal-safe calls are made */
+void watchdog(int sig) {
+    char buf[256];
+    size_t n = 0;
+    sig_atomic_t gen = watchgen;
+    double ms = msnow() - watchstart;
+    int e = errno;
+    (void)sig;
+
+    if (!watching || watchreported == gen || ms < STALL_THRESHOLD || gen != watchgen) return;
+    watchreported = gen;
+    n = sigappend(buf, n, sizeof(buf), "monsterwm: stall: ", 0, 0);
+    n = sigappend(buf, n, sizeof(buf), handlername(watchtype), 0, 0);
+    n = sigappend(buf, n, sizeof(buf), " for window 0x", watchwin, 16);
+    n = sigappend(buf, n, sizeof(buf), " running for ", ms, 10);
+    n = sigappend(buf, n, sizeof(buf), " ms", 0, 0);
+    for (unsigned int i = 0, pos = flightpos; i < FLIGHTRECS && i < pos; i++) {
+        flightrec *f = &flightlog[(pos - 1 - i) % FLIGHTRECS];
+        if (f->kind < FL_CONFIGURE || (f->kind > FL_RAISE && f->kind != FL_WAIT)) continue;
+        n = sigappend(buf, n, sizeof(buf), ", last request: ", 0, 0);
+        n = sigappend(buf, n, sizeof(buf), flightkinds[f->kind], 0, 0);
+        if (f->kind == FL_WAIT) n = sigappend(buf, n, sizeof(buf), " for opcode ", f->detail, 10);
+        n = sigappend(buf, n, sizeof(buf), " window 0x", f->win, 16);
+        n = sigappend(buf, n, sizeof(buf), " sequence ", f->value, 10);
+        break;
+    }
+    if (n == sizeof(buf)) n--;
+    buf[n++] = '\n';
+    if (write(STDERR_FILENO, buf, n) == -1) watchreported = 0; /* again on the next beat */
+    errno = e;
+}
+
+/* mark the end of the watched handler and return how long it ran. if
+ * that is over STALL_THRESHOLD ms it is counted as a stall of the
+ * handler, by how many times over, and recorded */
+double watchend(void) {
+    double ms = msnow() - watchstart;
+    watching = 0;
+    if (STALL_THRESHOLD && ms >= STALL_THRESHOLD) {
+        unsigned int k = 0;
+        for (double x = ms / STALL_THRESHOLD; x >= 2 && k < LENGTH(stallhist) - 1; x /= 2) k++;
+        stallhist[k]++;
+        stalls[watchtype < LENGTH(stalls) ? watchtype:0]++;
+        flight(FL_STALL, watchtype, watchwin, ms * 1000);
+    }
+    return ms;
 }
 
 /* find to which client the given window belongs to */
@@ -1250,18 +2735,44 @@ client* wintoclient(xcb_window_t w) {
     return c;
 }
 
+/* count an error of a request by the request's major opcode */
+void xerror(xcb_generic_event_t *e) {
+    xcb_generic_error_t *ev = (xcb_generic_error_t*)e;
+    DEBUGP("xcb: error: %d request: %d:%d\n", ev->error_code, ev->major_code, ev->minor_code);
+    xerrors[ev->major_code]++;
+    flight(FL_ERROR, ev->error_code, ev->resource_id, ev->major_code);
+}
+
 int main(int argc, char *argv[]) {
     int default_screen;
-    if (argc == 2 && argv[1][0] == '-') switch (argv[1][1]) {
-        case 'v': errx(EXIT_SUCCESS, "%s - by c00kiemon5ter >:3 omnomnomnom (extra cookies by Cloudef)", VERSION);
-        case 'h': errx(EXIT_SUCCESS, "%s", USAGE);
-        default: errx(EXIT_FAILURE, "%s", USAGE);
-    } else if (argc != 1) errx(EXIT_FAILURE, "%s", USAGE);
+    char *tracefile = NULL, *replayfile = NULL;
+    for (int i=1; i<argc; i++) {
+        if (argv[i][0] != '-' || !argv[i][1] || argv[i][2]) errx(EXIT_FAILURE, "%s", USAGE);
+        switch (argv[i][1]) {
+            case 'v': errx(EXIT_SUCCESS, "%s - by c00kiemon5ter >:3 omnomnomnom (extra cookies by Cloudef)", VERSION);
+            case 'h': errx(EXIT_SUCCESS, "%s", USAGE);
+            case 'T': timings = true; break;
+            case 'r': if (++i == argc) errx(EXIT_FAILURE, "%s", USAGE); tracefile = argv[i]; break;
+            case 'R': if (++i == argc) errx(EXIT_FAILURE, "%s", USAGE); replayfile = argv[i]; break;
+            case 'F': if (++i == argc) errx(EXIT_FAILURE, "%s", USAGE); flightprint(argv[i]); return EXIT_SUCCESS;
+            default: errx(EXIT_FAILURE, "%s", USAGE);
+        }
+    }
+    tphase = tstart = msnow();
+    snprintf(flightpath, sizeof(flightpath), "%s.%d", FLIGHT_FILE, (int)getpid());
+    struct sigaction sa = { .sa_handler = crash, .sa_flags = SA_RESETHAND };
+    int fatal[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    for (unsigned int i=0; i<LENGTH(fatal); i++) sigaction(fatal[i], &sa, NULL);
+    sigaction(SIGUSR2, &(struct sigaction){ .sa_handler = dumpsignal, .sa_flags = SA_RESTART }, NULL);
+    if (tracefile && (!(trace = fopen(tracefile, "wb")) || fwrite(TRACEMAGIC, sizeof(TRACEMAGIC) - 1, 1, trace) != 1))
+        err(EXIT_FAILURE, "cannot open trace %s", tracefile);
     if (xcb_connection_has_error((dis = xcb_connect(NULL, &default_screen))))
         errx(EXIT_FAILURE, "error: cannot open display\n");
+    fcntl(xcb_get_file_descriptor(dis), F_SETFD, FD_CLOEXEC);
+    startup_phase("connect");
     if (setup(default_screen) != -1) {
       desktopinfo(); /* zero out every desktop on (re)start */
-      run();
+      if (replayfile) replay(replayfile); else run();
     }
     cleanup();
     xcb_disconnect(dis);
@@ -0,0 +1,84 @@
+#!/bin/sh
+# soak test for monsterwm - see LICENSE for license and copyright information
+#
+# runs the wm on Xvfb and churns xterms through map, desktop move, unmap
+# and remap cycles, sampling the counters printed on SIGUSR1 before and
+# after. fails if the live clients or async requests do not come back to
+# their baseline, or the resident memory grows by more than SLACK kB.
+#
+# usage: ./soak.sh [cycles]
+# needs Xvfb, xdotool and xterm, and the default Mod1+F1/F2 desktop keys
+
+cycles=${1:-1000}
+warmup=${WARMUP:-50}
+slack=${SLACK:-512}
+dpy=${SOAK_DISPLAY:-:99}
+wm=${MONSTERWM:-./monsterwm}
+log=$(mktemp) || exit 2
+
+cleanup() {
+    kill $wmpid $xvfbpid 2>/dev/null
+    rm -f "$log"
+}
+trap cleanup EXIT
+trap 'exit 2' INT TERM
+
+for tool in Xvfb xdotool xterm; do
+    command -v $tool >/dev/null || { echo "soak: $tool not found" >&2; exit 2; }
+done
+
+Xvfb "$dpy" -screen 0 1280x800x24 -nolisten tcp 2>/dev/null &
+xvfbpid=$!
+export DISPLAY=$dpy
+i=0
+until xdotool getdisplaygeometry >/dev/null 2>&1; do
+    i=$((i + 1)); [ $i -gt 50 ] && { echo "soak: Xvfb did not start" >&2; exit 2; }
+    sleep 0.1
+done
+
+"$wm" 2>"$log" >/dev/null &
+wmpid=$!
+sleep 1
+kill -0 $wmpid 2>/dev/null || { echo "soak: $wm did not start" >&2; cat "$log" >&2; exit 2; }
+
+# one client through a map, a move to desktop 2 and back, an unmap and a remap
+cycle() {
+    xterm -name soak$1 -e sleep 600 &
+    pid=$!
+    win=$(xdotool search --sync --onlyvisible --classname "^soak$1\$" | head -n 1)
+    xdotool key alt+shift+F2 key alt+F2
+    xdotool windowunmap --sync $win windowmap --sync $win
+    xdotool key alt+F1
+    kill $pid
+}
+
+# wait for the clients to be gone, then print clients, requests, queued
+# replies and errors, and rss from the counters the wm prints on SIGUSR1
+sample() {
+    i=0
+    while xdotool search --classname '^soak' >/dev/null 2>&1 && [ $i -lt 100 ]; do i=$((i + 1)); sleep 0.1; done
+    sleep 1
+    kill -USR1 $wmpid
+    sleep 1
+    sed -n 's/^monsterwm: clients: \([0-9]*\) .* requests: \([0-9]*\) .* queued replies and errors: \([0-9]*\) rss: \([0-9]*\) kB$/\1 \2 \3 \4/p' "$log" | tail -n 1
+}
+
+n=0
+while [ $n -lt $warmup ]; do cycle w$n; n=$((n + 1)); done
+set -- $(sample)
+[ $# -eq 4 ] || { echo "soak: no counters from $wm" >&2; exit 2; }
+clients=$1 requests=$2 queued=$3 rss=$4
+echo "soak: baseline clients: $clients requests: $requests queued: $queued rss: $rss kB"
+
+n=0
+while [ $n -lt $cycles ]; do cycle $n; n=$((n + 1)); done
+set -- $(sample)
+[ $# -eq 4 ] || { echo "soak: no counters from $wm" >&2; exit 2; }
+echo "soak: after $cycles cycles clients: $1 requests: $2 queued: $3 rss: $4 kB"
+
+kill -0 $wmpid 2>/dev/null || { echo "soak: $wm died" >&2; exit 1; }
+if [ $1 -ne $clients ] || [ $2 -ne $requests ] || [ $3 -ne $queued ] || [ $4 -gt $((rss + slack)) ]; then
+    echo "soak: usage did not return to baseline" >&2
+    exit 1
+fi
+echo "soak: ok"